@@ -25,6 +25,19 @@ struct rpg_stats{
 	int mage_levels;
 };
 
+/* gang scheduling modes and statistics of sys_rpg_gang, see sched.c */
+#define RPG_GANG_QUERY -1
+#define RPG_GANG_OFF 0
+#define RPG_GANG_ON 1
+
+struct rpg_gang_stats{
+	int gang;			/* RPG_GANG_OFF or RPG_GANG_ON */
+	unsigned long slots;		/* gang slots started */
+	unsigned long ipis;		/* reschedule IPIs sent to co-schedule members */
+	unsigned long ticks;		/* ticks a member ran */
+	unsigned long full_ticks;	/* ticks all runnable members ran at once */
+};
+
 
 
 
@@ -44,6 +57,8 @@ void update_leader(struct task_struct* dest);
 void move_my_node(pid_t my_id,struct task_struct* old_leader,struct task_struct* new_leader);
 int rpg_fork(struct task_struct* son);
 int rpg_exit(struct task_struct* proc);
+int sys_rpg_gang(int mode, struct rpg_gang_stats *stats);
+int sys_rpg_yield_to(pid_t pid);
 
 
 
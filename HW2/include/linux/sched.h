@@ -458,6 +458,9 @@ struct task_struct {
 	int party_member;
 	struct list_head party_list;
 	struct task_struct* group_leader;
+	struct party_runqueue* party_rq;	/* runnable members of my party, see sched.c */
+	list_t party_run_list;
+	cycles_t wake_tsc;	/* when we were last woken, 0 once we ran */
 /*****************************************/
 	
 
@@ -513,6 +516,12 @@ extern int task_prio(task_t *p);
 extern int task_nice(task_t *p);
 extern int idle_cpu(int cpu);
 
+struct party_runqueue;
+extern struct party_runqueue *sched_alloc_party_rq(void);
+extern void sched_put_party_rq(struct party_runqueue *prq);
+extern struct party_runqueue *sched_get_party_rq(task_t *p);
+extern void sched_set_party_rq(task_t *p, struct party_runqueue *prq);
+
 asmlinkage long sys_sched_yield(void);
 #define yield() sys_sched_yield()
 
@@ -570,6 +579,8 @@ extern struct exec_domain	default_exec_domain;
     party_member:	0,						\
     party_list:		LIST_HEAD_INIT(tsk.party_list),			\
     group_leader:	&tsk,						\
+    party_rq:		NULL,						\
+    party_run_list:	LIST_HEAD_INIT(tsk.party_run_list),		\
 }
 
 
@@ -64,10 +64,18 @@ int sys_rpg_create_character(int cclass){
 			//errno = EINVAL;
 			return -EINVAL;
 		}
+		//every party has a runqueue of its runnable members, see sched.c
+		struct party_runqueue *prq = sched_alloc_party_rq();
+		if(prq == NULL){
+			kfree(character);
+			return -ENOMEM;
+		}
 		//player is not a part of a party, he is his own group leader
 		current_task -> group_leader = current_task;
 		//add player to his party list
 		list_add_tail(&character->my_list, &(current_task->party_list));
+		sched_set_party_rq(current_task, prq);
+		sched_put_party_rq(prq);
 		//printk(KERN_INFO " process has created character with pid %d\n",character->player_pid);
 		return SUCCESS; 
 	}
@@ -251,22 +259,34 @@ int get_player_level(struct task_struct* leader,pid_t pid){
 
 int sys_rpg_join(pid_t player){
 	struct task_struct *current_task = current;
+	struct party_runqueue *prq;
 	//printk(KERN_INFO "in join pid input is %d\n",player);
 	struct task_struct *player_task;
+	//tasklist_lock keeps player_task from being released under us, nothing here sleeps
+	read_lock(&tasklist_lock);
 	player_task = find_task_by_pid(player); 
 	//printk(KERN_INFO "process with pid %d is trying to join process with pid %d\n",current_task->pid,player_task->pid);
 	if(!player_task){
 		//printk(KERN_INFO "player does not exist\n");
 		//player doesn't exist
 		//errno = ESRCH;
+		read_unlock(&tasklist_lock);
 		return -ESRCH;
 	}
 	if(!has_character(current_task) || !has_character(player_task)){
 		//printk(KERN_INFO "has no character\n");
 		//process or player does not havs a character
 		//errno = EINVAL;
+		read_unlock(&tasklist_lock);
 		return -EINVAL;
 	}
+	//hold the player's party runqueue before we touch any list: if the
+	//player's rpg_exit() already left it, there is no party to join
+	prq = sched_get_party_rq(player_task);
+	if(!prq){
+		read_unlock(&tasklist_lock);
+		return -ESRCH;
+	}
 	if(current_task->party_member == NOT_A_MEMBER){
 		//proccess in not a party member
 		//printk(KERN_INFO "player is not a party member\n");
@@ -298,6 +318,10 @@ int sys_rpg_join(pid_t player){
 
 		}
 	}
+	read_unlock(&tasklist_lock);
+	//schedule with my new party
+	sched_set_party_rq(current_task, prq);
+	sched_put_party_rq(prq);
 	
 	return SUCCESS;
 	
@@ -376,6 +400,8 @@ int rpg_fork(struct task_struct* son){
 	INIT_LIST_HEAD(&son->party_list);
 
 	son->group_leader = son;
+	son->party_rq = NULL;
+	INIT_LIST_HEAD(&son->party_run_list);
 	return 0;
 }
 
@@ -386,6 +412,8 @@ int rpg_exit(struct task_struct* proc){
 		//proccess has no character
 		return 0;
 	}
+	//leave my party runqueue
+	sched_set_party_rq(proc, NULL);
 	//check if the proccess is a party leader
 	if(proc->group_leader == proc){
 		//assign new leader and delete my node
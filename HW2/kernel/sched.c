@@ -26,6 +26,7 @@
 #include <linux/interrupt.h>
 #include <linux/completion.h>
 #include <linux/kernel_stat.h>
+#include <linux/proc_fs.h>
 
 /******* adding******/
 #include <linux/rpg_funcs.h>
@@ -72,6 +73,19 @@
 #define INTERACTIVE_DELTA	2
 #define MAX_SLEEP_AVG		(2*HZ)
 #define STARVATION_LIMIT	(2*HZ)
+#define GANG_TIMESLICE		(100 * HZ / 1000)
+/*
+ * Party boost: members of a party get PARTY_BOOST better priority, for
+ * at most PARTY_BOOST_LIMIT member ticks per PARTY_ROUND, so a party keeps
+ * its locality without starving others. See effective_prio(). The round
+ * is counted in jiffies, so it is the same for members on every CPU.
+ */
+#define PARTY_BOOST		2
+#define PARTY_BOOST_LIMIT	(MAX_TIMESLICE)
+#define PARTY_ROUND		(HZ)
+/* in fair share mode a party gets the timeslice of one nice 0 task per round */
+#define PARTY_TIMESLICE		(MIN_TIMESLICE + \
+	((MAX_TIMESLICE - MIN_TIMESLICE) * 19 / 39))
 
 /*
  * If a task is 'interactive' then we reinsert it in the active
@@ -129,10 +143,17 @@
 
 #define BITMAP_SIZE ((((MAX_PRIO+1+7)/8)+sizeof(long)-1)/sizeof(long))
 
+/* wakeup latency histograms, bucket k counts waits of [2^k, 2^(k+1)) cycles */
+#define LAT_BUCKETS 32
+
 typedef struct runqueue runqueue_t;
 
 /******declare funcss********/
 task_t* custom_pick_next(task_t* prev);
+static task_t* party_best_on_cpu(struct party_runqueue *prq, task_t* skip, int cpu, prio_array_t *array);
+static inline int party_boost_ok(task_t *p);
+static inline void double_rq_lock(runqueue_t *rq1, runqueue_t *rq2);
+static inline void double_rq_unlock(runqueue_t *rq1, runqueue_t *rq2);
 //task_t* locate_next_member(task_t* prev,task_t* leader,runqueue_t *rq);
 //int get_active_member_prio(task_t* prev,task_t* leader,runqueue_t *rq);
 //int get_expired_member_prio(task_t* leader,runqueue_t* rq);
@@ -161,10 +182,80 @@ struct runqueue {
 	int prev_nr_running[NR_CPUS];
 	task_t *migration_thread;
 	list_t migration_queue;
+	struct party_runqueue *gang;	/* gang slot hint, holds a reference */
+	unsigned long curr_timestamp;	/* when curr was switched in */
+	task_t *yield_to;		/* directed yield, queued here or NULL */
 } ____cacheline_aligned;
 
 static struct runqueue runqueues[NR_CPUS] __cacheline_aligned;
 
+/*
+ * Fair share between parties: when party_fair is set, a party gets the
+ * PARTY_TIMESLICE of one nice 0 task per array switch, divided evenly
+ * among its runnable members, and members always expire at the end of
+ * their part. So a big party can not starve a small one, or anybody
+ * else. Set through /proc/party_shares.
+ */
+static int party_fair;
+static unsigned long party_total_ticks;	/* all non-idle ticks, for shares */
+
+/*
+ * Wakeup preemption within a party: a member that wakes up with at least
+ * the priority of a running member of its party takes the CPU over, once
+ * the running one had party_wakeup_gran ticks. Set through
+ * /proc/party_wakeup_gran.
+ */
+static int party_wakeup_gran = MIN_TIMESLICE;
+
+/* every party runqueue, for /proc/party_shares */
+static LIST_HEAD(party_rqs);
+static spinlock_t party_rqs_lock = SPIN_LOCK_UNLOCKED;
+static int party_next_id;
+
+/* the members of a party queued in one prio_array */
+struct party_array {
+	int nr_active;
+	unsigned long bitmap[BITMAP_SIZE];
+	list_t queue[MAX_PRIO];
+};
+
+/* the party_arrays of one CPU, for its rq->arrays[0] and [1]. a party
+	gets them for a CPU the first time a member is queued there */
+struct party_cpu {
+	struct party_array arrays[2];
+};
+
+/*
+ * Per-party runqueue: the runnable members of one RPG party. They are
+ * kept in one party_array per CPU and per prio_array of that CPU, indexed
+ * by priority like a prio_array, so custom_pick_next() finds the best
+ * member queued in this CPU's active array with a sched_find_first_bit(),
+ * without looking at expired members or members of other CPUs.
+ * It is shared by all members (p->party_rq) and refcounted, so it does
+ * not move when the party leader changes.
+ *
+ * Locking rule: party_rq->lock nests inside the runqueue lock, members
+ * of one party may sit on different runqueues.
+ */
+struct party_runqueue {
+	spinlock_t lock;
+	atomic_t count;
+	int nr_running;
+	int home_cpu;		/* where members are packed, see try_to_wake_up() */
+	int gang;		/* co-schedule members across CPUs, see gang_start() */
+	unsigned long gang_expires;	/* end of the current gang slot */
+	atomic_t nr_on_cpu;	/* members running right now */
+	unsigned long gang_slots, gang_ipis, gang_ticks, gang_full_ticks;
+	int id;			/* for /proc/party_shares */
+	list_t all_list;	/* on party_rqs */
+	unsigned long round_expires;	/* end of the current PARTY_ROUND */
+	unsigned long ticks;	/* ticks members ran */
+	int boost_left;		/* boosted member ticks left in this round */
+	unsigned long boost_ticks;	/* ticks members ran boosted */
+	unsigned long lat[LAT_BUCKETS];	/* members' wakeup latency, see lat_account() */
+	struct party_cpu *cpus[NR_CPUS];	/* NULL until used, see party_array() */
+};
+
 #define cpu_rq(cpu)		(runqueues + (cpu))
 #define this_rq()		cpu_rq(smp_processor_id())
 #define task_rq(p)		cpu_rq((p)->cpu)
@@ -229,12 +320,112 @@ static inline void rq_unlock(runqueue_t *rq)
 /*
  * Adding/removing a task to/from a priority array:
  */
+/*
+ * The party_array of prq that mirrors array of cpu's runqueue, NULL if no
+ * member was ever queued on cpu. It is picked by the physical array,
+ * rq->arrays[0] or [1], so it stays right when schedule() swaps
+ * rq->active and rq->expired.
+ */
+static inline struct party_array *party_array(struct party_runqueue *prq,
+	int cpu, prio_array_t *array)
+{
+	struct party_cpu *pc = prq->cpus[cpu];
+
+	return pc ? pc->arrays + (array - cpu_rq(cpu)->arrays) : NULL;
+}
+
+static struct party_cpu *party_cpu_alloc(int gfp_mask)
+{
+	struct party_cpu *pc;
+	struct party_array *parray;
+	int i, k;
+
+	pc = kmalloc(sizeof(struct party_cpu), gfp_mask);
+	if (!pc)
+		return NULL;
+	for (i = 0; i < 2; i++) {
+		parray = pc->arrays + i;
+		parray->nr_active = 0;
+		for (k = 0; k < MAX_PRIO; k++) {
+			INIT_LIST_HEAD(parray->queue + k);
+			__clear_bit(k, parray->bitmap);
+		}
+		// delimiter for bitsearch
+		__set_bit(MAX_PRIO, parray->bitmap);
+	}
+	return pc;
+}
+
+/*
+ * Give prq the party_arrays of cpu, from party_enqueue() with cpu's
+ * rq->lock held, so no other enqueue installs them meanwhile. Installed
+ * under prq->lock for gang_start(), which looks at every CPU.
+ * Returns 0 if there is no memory.
+ */
+static int party_cpu_add(struct party_runqueue *prq, int cpu)
+{
+	struct party_cpu *pc = party_cpu_alloc(GFP_ATOMIC);
+
+	if (!pc)
+		return 0;
+	spin_lock(&prq->lock);
+	prq->cpus[cpu] = pc;
+	spin_unlock(&prq->lock);
+	return 1;
+}
+
+/*
+ * Mirror a task's presence in a prio_array into its party runqueue.
+ * The task's rq->lock is held, and p->prio and p->cpu only change
+ * while the task is dequeued.
+ */
+static inline void party_enqueue(task_t *p, prio_array_t *array)
+{
+	struct party_runqueue *prq = p->party_rq;
+	struct party_array *parray;
+
+	if (!prq)
+		return;
+	/*
+	 * Without memory p is not mirrored until its next enqueue: it is
+	 * scheduled like a task without a party, party_dequeue() sees its
+	 * empty party_run_list and skips it.
+	 */
+	if (unlikely(!prq->cpus[p->cpu]) && !party_cpu_add(prq, p->cpu))
+		return;
+	parray = party_array(prq, p->cpu, array);
+	spin_lock(&prq->lock);
+	list_add_tail(&p->party_run_list, parray->queue + p->prio);
+	__set_bit(p->prio, parray->bitmap);
+	parray->nr_active++;
+	prq->nr_running++;
+	spin_unlock(&prq->lock);
+}
+
+static inline void party_dequeue(task_t *p, prio_array_t *array)
+{
+	struct party_runqueue *prq = p->party_rq;
+	struct party_array *parray;
+
+	if (!prq || list_empty(&p->party_run_list))
+		return;
+	parray = party_array(prq, p->cpu, array);
+	spin_lock(&prq->lock);
+	prq->nr_running--;
+	parray->nr_active--;
+	list_del_init(&p->party_run_list);
+	if (list_empty(parray->queue + p->prio))
+		__clear_bit(p->prio, parray->bitmap);
+	spin_unlock(&prq->lock);
+}
+
 static inline void dequeue_task(struct task_struct *p, prio_array_t *array)
 {
 	array->nr_active--;
 	list_del(&p->run_list);
 	if (list_empty(array->queue + p->prio))
 		__clear_bit(p->prio, array->bitmap);
+	party_dequeue(p, array);
 }
 
 static inline void enqueue_task(struct task_struct *p, prio_array_t *array)
@@ -243,6 +434,7 @@ static inline void enqueue_task(struct task_struct *p, prio_array_t *array)
 	__set_bit(p->prio, array->bitmap);
 	array->nr_active++;
 	p->array = array;
+	party_enqueue(p, array);
 }
 
 static inline int effective_prio(task_t *p)
@@ -264,6 +456,9 @@ static inline int effective_prio(task_t *p)
 			MAX_USER_PRIO*PRIO_BONUS_RATIO/100/2;
 
 	prio = p->static_prio - bonus;
+	/* bounded party boost, it runs out each round and when the expired array starves */
+	if (p->party_rq && party_boost_ok(p))
+		prio -= PARTY_BOOST;
 	if (prio < MAX_RT_PRIO)
 		prio = MAX_RT_PRIO;
 	if (prio > MAX_PRIO-1)
@@ -295,6 +490,8 @@ static inline void activate_task(task_t *p, runqueue_t *rq)
 
 static inline void deactivate_task(struct task_struct *p, runqueue_t *rq)
 {
+	if (unlikely(rq->yield_to == p))
+		rq->yield_to = NULL;
 	rq->nr_running--;
 	if (p->state == TASK_UNINTERRUPTIBLE)
 		rq->nr_uninterruptible++;
@@ -317,6 +514,24 @@ static inline void resched_task(task_t *p)
 #endif
 }
 
+/*
+ * p was just queued on rq. The plain O(1) rule preempts for a better
+ * priority only; a member of the running task's party also preempts on a
+ * tie, which is what schedule() would pick anyway, so a request/response
+ * pair hands the CPU over at once instead of at the next tick.
+ */
+static inline void wakeup_preempt(task_t *p, runqueue_t *rq)
+{
+	task_t *curr = rq->curr;
+
+	if (p->prio < curr->prio)
+		resched_task(curr);
+	else if (p->party_rq && (p->party_rq == curr->party_rq) &&
+			(p->prio == curr->prio) && (p->array == rq->active) &&
+			(jiffies - rq->curr_timestamp >= party_wakeup_gran))
+		resched_task(curr);
+}
+
 #ifdef CONFIG_SMP
 
 /*
@@ -377,6 +592,27 @@ repeat_lock_task:
 	rq = task_rq_lock(p, &flags);
 	old_state = p->state;
 	if (!p->array) {
+#if CONFIG_SMP
+		/*
+		 * Party members are packed onto their party's home CPU,
+		 * so they share its cache and custom_pick_next() can
+		 * switch between them, unless home is busier than the
+		 * CPU p would wake on: then the cache is not worth the
+		 * wait and load_balance() would only pull p back. Gang
+		 * parties want the opposite and are left spread. Do not
+		 * violate hard affinity.
+		 */
+		if (p->party_rq && !p->party_rq->gang && (rq->curr != p)) {
+			int home = p->party_rq->home_cpu;
+
+			if ((home != p->cpu) && (p->cpus_allowed & (1UL << home)) &&
+					(cpu_rq(home)->nr_running <= rq->nr_running)) {
+				p->cpu = home;
+				task_rq_unlock(rq, &flags);
+				goto repeat_lock_task;
+			}
+		} else
+#endif
 		/*
 		 * Fast-migrate the task if it's not running or runnable
 		 * currently. Do not violate hard affinity.
@@ -392,11 +628,11 @@ repeat_lock_task:
 		if (old_state == TASK_UNINTERRUPTIBLE)
 			rq->nr_uninterruptible--;
 		activate_task(p, rq);
+		p->wake_tsc = get_cycles();
 		/*
 		 * If sync is set, a resched_task() is a NOOP
 		 */
-		if (p->prio < rq->curr->prio)
-			resched_task(rq->curr);
+		wakeup_preempt(p, rq);
 		success = 1;
 	}
 	p->state = TASK_RUNNING;
@@ -427,6 +663,9 @@ void wake_up_forked_process(task_t * p)
 	}
 	p->cpu = smp_processor_id();
 	activate_task(p, rq);
+	p->wake_tsc = get_cycles();
+	if (p->party_rq)
+		wakeup_preempt(p, rq);
 
 	rq_unlock(rq);
 }
@@ -543,6 +782,58 @@ static inline unsigned int double_lock_balance(runqueue_t *this_rq,
 	return nr_running;
 }
 
+/*
+ * Move a task from the locked src runqueue to the locked this_rq.
+ */
+static inline void pull_task(task_t *p, runqueue_t *src, runqueue_t *this_rq,
+	int this_cpu)
+{
+	if (unlikely(src->yield_to == p))
+		src->yield_to = NULL;
+	dequeue_task(p, p->array);
+	src->nr_running--;
+	p->cpu = this_cpu;
+	this_rq->nr_running++;
+	enqueue_task(p, this_rq->active);
+	if (p->prio < current->prio)
+		set_need_resched();
+}
+
+/*
+ * Collect the members of p's party that are queued on rq (p included),
+ * at most PARTY_PULL_MAX of them. rq is locked, so they can not leave it
+ * or their party while we use the list.
+ */
+#define PARTY_PULL_MAX 32
+
+static int party_members_on(task_t *p, runqueue_t *rq, task_t **members)
+{
+	struct party_runqueue *prq = p->party_rq;
+	struct party_array *parray;
+	int cpu = rq - runqueues;
+	list_t *pos;
+	int i, idx, n = 0;
+
+	spin_lock(&prq->lock);
+	for (i = 0; i < 2; i++) {
+		parray = party_array(prq, cpu, rq->arrays + i);
+		if (!parray)
+			break;
+		idx = sched_find_first_bit(parray->bitmap);
+		while (idx < MAX_PRIO) {
+			list_for_each(pos, parray->queue + idx) {
+				if (n == PARTY_PULL_MAX)
+					goto out;
+				members[n++] = list_entry(pos, task_t, party_run_list);
+			}
+			idx = find_next_bit(parray->bitmap, MAX_PRIO, idx + 1);
+		}
+	}
+out:
+	spin_unlock(&prq->lock);
+	return n;
+}
+
 /*
  * Current runqueue is empty, or rebalance tick: if there is an
  * inbalance (current runqueue is too short) then pull from
@@ -556,6 +847,7 @@ static void load_balance(runqueue_t *this_rq, int idle)
 	int imbalance, nr_running, load, max_load,
 		idx, i, this_cpu = smp_processor_id();
 	task_t *next = this_rq->idle, *tmp;
+	task_t *members[PARTY_PULL_MAX];
 	runqueue_t *busiest, *rq_src;
 	prio_array_t *array;
 	list_t *head, *curr;
@@ -628,6 +920,7 @@ static void load_balance(runqueue_t *this_rq, int idle)
 	 * be cache-cold, thus switching CPUs has the least effect
 	 * on them.
 	 */
+restart:
 	if (busiest->expired->nr_active)
 		array = busiest->expired;
 	else
@@ -675,17 +968,46 @@ skip_queue:
 		goto skip_bitmap;
 	}
 	next = tmp;
+	/*
+	 * Party members move as a whole party, and the party's home
+	 * CPU moves with them. A party that is bigger than the
+	 * imbalance is left where it is, splitting it would cost
+	 * its cache locality.
+	 */
+	if (next->party_rq && !next->party_rq->gang) {
+		int n = party_members_on(next, busiest, members);
+
+		if (!idle && (n > imbalance)) {
+			if (curr != head)
+				goto skip_queue;
+			idx++;
+			goto skip_bitmap;
+		}
+		/*
+		 * next can migrate, so it always moves, even when it is
+		 * past the PARTY_PULL_MAX members we collected. Every
+		 * restart pulls at least one task and the home CPU only
+		 * follows a party that did move.
+		 */
+		pull_task(next, busiest, this_rq, this_cpu);
+		imbalance--;
+		for (i = 0; i < n; i++)
+			if ((members[i] != next) &&
+					CAN_MIGRATE_TASK(members[i], busiest, this_cpu)) {
+				pull_task(members[i], busiest, this_rq, this_cpu);
+				imbalance--;
+			}
+		next->party_rq->home_cpu = this_cpu;
+		/* the queue we were walking changed, start over */
+		if (!idle && (imbalance > 0))
+			goto restart;
+		goto out_unlock;
+	}
 	/*
 	 * take the task out of the other runqueue and
 	 * put it into this one:
 	 */
-	dequeue_task(next, array);
-	busiest->nr_running--;
-	next->cpu = this_cpu;
-	this_rq->nr_running++;
-	enqueue_task(next, this_rq->active);
-	if (next->prio < current->prio)
-		set_need_resched();
+	pull_task(next, busiest, this_rq, this_cpu);
 	if (!idle && --imbalance) {
 		if (curr != head)
 			goto skip_queue;
@@ -733,6 +1055,69 @@ static inline void idle_tick(void)
 		(jiffies - (rq)->expired_timestamp >= \
 			STARVATION_LIMIT * ((rq)->nr_running) + 1))
 
+/*
+ * Gang statistics: count the ticks a gang member ran, and the ticks in
+ * which every runnable member (up to one per CPU) was running at once.
+ * At the end of the party's gang slot the member is rescheduled, so all
+ * the CPUs of the gang decide again at the same moment.
+ */
+static inline void gang_tick(task_t *p)
+{
+	struct party_runqueue *prq = p->party_rq;
+	int want;
+
+	spin_lock(&prq->lock);
+	want = prq->nr_running;
+	if (want > smp_num_cpus)
+		want = smp_num_cpus;
+	prq->gang_ticks++;
+	if (atomic_read(&prq->nr_on_cpu) >= want)
+		prq->gang_full_ticks++;
+	if (!time_before(jiffies, prq->gang_expires))
+		set_tsk_need_resched(p);
+	spin_unlock(&prq->lock);
+}
+
+/*
+ * Charge a tick to p's party and to its boost. The boost is refilled
+ * when a new PARTY_ROUND starts, whichever CPU the member ticks on.
+ */
+static inline void party_charge(task_t *p)
+{
+	struct party_runqueue *prq = p->party_rq;
+
+	spin_lock(&prq->lock);
+	prq->ticks++;
+	if (!time_before(jiffies, prq->round_expires)) {
+		prq->round_expires = jiffies + PARTY_ROUND;
+		prq->boost_left = PARTY_BOOST_LIMIT;
+	}
+	if (prq->boost_left > 0) {
+		prq->boost_left--;
+		prq->boost_ticks++;
+	}
+	spin_unlock(&prq->lock);
+}
+
+/* may p's party still be boosted: it has boost left in this round and
+	the expired tasks of its runqueue are not starving */
+static inline int party_boost_ok(task_t *p)
+{
+	return (p->party_rq->boost_left > 0) && !EXPIRED_STARVING(task_rq(p));
+}
+
+/* a member's own slice in fair share mode: the party's, split evenly
+	between its runnable members whatever their nice */
+static inline unsigned int party_member_slice(task_t *p)
+{
+	int nr = p->party_rq->nr_running;
+	unsigned int slice = PARTY_TIMESLICE;
+
+	if (nr > 1)
+		slice /= nr;
+	return slice ? slice : 1;
+}
+
 /*
  * This function gets called by the timer code, with HZ frequency.
  * We call it with interrupts disabled.
@@ -757,6 +1142,10 @@ void scheduler_tick(int user_tick, int system)
 		kstat.per_cpu_user[cpu] += user_tick;
 	kstat.per_cpu_system[cpu] += system;
 
+	party_total_ticks++;
+	if (unlikely(p->party_rq && p->party_rq->gang))
+		gang_tick(p);
+
 	/* Task might have expired already, but not scheduled off yet */
 	if (p->array != rq->active) {
 		set_tsk_need_resched(p);
@@ -789,14 +1178,29 @@ void scheduler_tick(int user_tick, int system)
 	 */
 	if (p->sleep_avg)
 		p->sleep_avg--;
+	if (p->party_rq) {
+		party_charge(p);
+		/*
+		 * A member never runs past its part of the party's slice,
+		 * also when it got a bigger slice before it joined or
+		 * before more members became runnable.
+		 */
+		if (party_fair && (p->time_slice > party_member_slice(p)))
+			p->time_slice = party_member_slice(p);
+	}
 	if (!--p->time_slice) {
 		dequeue_task(p, rq->active);
 		set_tsk_need_resched(p);
 		p->prio = effective_prio(p);
 		p->first_time_slice = 0;
 		p->time_slice = TASK_TIMESLICE(p);
+		if (party_fair && p->party_rq)
+			p->time_slice = party_member_slice(p);
 
-		if (!TASK_INTERACTIVE(p) || EXPIRED_STARVING(rq)) {
+		/* in fair share mode the party waits for the array switch
+			like one task would, interactive members too */
+		if (!TASK_INTERACTIVE(p) || EXPIRED_STARVING(rq) ||
+				(party_fair && p->party_rq)) {
 			if (!rq->expired_timestamp)
 				rq->expired_timestamp = jiffies;
 			enqueue_task(p, rq->expired);
@@ -815,29 +1219,705 @@ void scheduling_functions_start_here(void) { }
 
 
 /* my costum scheduling functions----------- and the start of my changes*************/
+/* find the best runnable member of curr's party on this CPU, other than curr.
+	NULL if there is none, curr itself never gets picked this way: it is
+	requeued like any task and waits for its turn in round robin.
+	called with rq->lock held, the party runqueue keeps the members by CPU,
+	array and prio so this is a bitmap search and not a walk over the party */
 task_t* custom_pick_next(task_t* curr){
-	task_t* next_task = curr;
-	int max_prio = MAX_PRIO + 1;
-	//proccess is a party member, locate next proccess
-    task_t* leader =  curr->group_leader;
-	//int prio = curr->prio;
-	struct player *entry;
-	struct list_head* tmp;
+	task_t* next_task = NULL;
+	if(curr->party_rq){
+		next_task = party_best_on_cpu(curr->party_rq, curr, curr->cpu, this_rq()->active);
+	}
+	return next_task;
+}
+
+/* the best runnable member of a party that is queued on cpu in array, other
+	than skip. NULL if there is none. only the members of that one array are
+	searched, and skip is the only one we may have to step over */
+static task_t* party_best_on_cpu(struct party_runqueue *prq, task_t* skip, int cpu, prio_array_t *array){
+	struct party_array *parray = party_array(prq, cpu, array);
+	task_t* next_task = NULL;
 	struct list_head* position;
-	list_for_each_safe(position,tmp, &(leader->party_list)){
-		entry = list_entry (position, struct player, my_list);
-        task_t* task = find_task_by_pid(entry->player_pid);
-		//printk(KERN_INFO "#############CHECKING MY PARTY MEMBER WITH PID %d AND PRIO %d\n",task->pid,task->prio);
-		if(task->state == TASK_RUNNING && task->pid != curr->pid){
-			int task_prio = task->prio;
-			if(task_prio < max_prio){
-				max_prio = task_prio;
-				next_task = task;	
+	task_t* task;
+	int idx;
+
+	if(!parray)
+		return NULL;
+	spin_lock(&prq->lock);
+	idx = sched_find_first_bit(parray->bitmap);
+	while(idx < MAX_PRIO){
+		list_for_each(position, parray->queue + idx){
+			task = list_entry(position, task_t, party_run_list);
+			if(task != skip){
+				next_task = task;
+				goto out;
 			}
 		}
+		idx = find_next_bit(parray->bitmap, MAX_PRIO, idx + 1);
+	}
+out:
+	spin_unlock(&prq->lock);
+	return next_task;
+}
+
+/*
+ * Gang scheduling: when a member of a gang party is switched in and the
+ * party has no slot running, a slot of GANG_TIMESLICE starts. Every other
+ * CPU that has a member queued gets a hint in rq->gang and a reschedule
+ * IPI, and its schedule() then runs that member (gang_pick_next()).
+ * Called with rq->lock held.
+ */
+static void gang_start(task_t *next)
+{
+	struct party_runqueue *prq = next->party_rq;
+	int this_cpu = smp_processor_id();
+	unsigned long cpus = 0;
+	int cpu, queued;
+
+	spin_lock(&prq->lock);
+	if (time_before(jiffies, prq->gang_expires)) {
+		spin_unlock(&prq->lock);
+		return;
+	}
+	prq->gang_expires = jiffies + GANG_TIMESLICE;
+	prq->gang_slots++;
+	//a CPU wants the hint if a member is queued there besides its curr
+	for (cpu = 0; cpu < smp_num_cpus; cpu++) {
+		if (cpu == this_cpu)
+			continue;
+		if (!prq->cpus[cpu])
+			continue;
+		queued = prq->cpus[cpu]->arrays[0].nr_active +
+			prq->cpus[cpu]->arrays[1].nr_active;
+		if (cpu_curr(cpu)->party_rq == prq)
+			queued--;
+		if (queued > 0)
+			cpus |= 1UL << cpu;
+	}
+	spin_unlock(&prq->lock);
+#if CONFIG_SMP
+	{
+		struct party_runqueue *old;
+
+		for (cpu = 0; cpus; cpu++, cpus >>= 1) {
+			if (!(cpus & 1))
+				continue;
+			atomic_inc(&prq->count);
+			old = xchg(&cpu_rq(cpu)->gang, prq);
+			if (old)
+				sched_put_party_rq(old);
+			smp_send_reschedule(cpu);
+			spin_lock(&prq->lock);
+			prq->gang_ipis++;
+			spin_unlock(&prq->lock);
+		}
+	}
+#endif
+}
+
+#if CONFIG_SMP
+/* take this CPU's gang hint, and the member it asks for if its slot is still on */
+static task_t* gang_pick_next(runqueue_t *rq)
+{
+	struct party_runqueue *prq = xchg(&rq->gang, NULL);
+	task_t *next_task = NULL;
+
+	if (!prq)
+		return NULL;
+	if (prq->gang && time_before(jiffies, prq->gang_expires))
+		next_task = party_best_on_cpu(prq, NULL, smp_processor_id(), rq->active);
+	sched_put_party_rq(prq);
+	return next_task;
+}
+#endif
+
+/*
+ * /proc/party_shares: the share of the CPU time each party received,
+ * write 1 or 0 to turn fair share mode on or off.
+ */
+static int party_shares_read(char *page, char **start, off_t off,
+	int count, int *eof, void *data)
+{
+	struct party_runqueue *prq;
+	unsigned long total = party_total_ticks;
+	list_t *pos;
+	int len;
+
+	len = sprintf(page, "fair %d total_ticks %lu\n"
+		"party running ticks share%% boosted\n", party_fair, total);
+	spin_lock_irq(&party_rqs_lock);
+	list_for_each(pos, &party_rqs) {
+		prq = list_entry(pos, struct party_runqueue, all_list);
+		if (len > PAGE_SIZE - 80)
+			break;
+		len += sprintf(page + len, "%5d %7d %10lu %5lu %10lu\n", prq->id,
+			prq->nr_running, prq->ticks,
+			total ? prq->ticks * 100 / total : 0, prq->boost_ticks);
+	}
+	spin_unlock_irq(&party_rqs_lock);
+	*eof = 1;
+	return len;
+}
+
+static int party_shares_write(struct file *file, const char *buffer,
+	unsigned long count, void *data)
+{
+	char c;
+
+	if (!capable(CAP_SYS_NICE))
+		return -EPERM;
+	if (!count || get_user(c, buffer))
+		return -EFAULT;
+	if (c != '0' && c != '1')
+		return -EINVAL;
+	party_fair = c - '0';
+	return count;
+}
+
+static int __init party_shares_init(void)
+{
+	struct proc_dir_entry *entry;
+
+	entry = create_proc_entry("party_shares", 0644, NULL);
+	if (entry) {
+		entry->read_proc = party_shares_read;
+		entry->write_proc = party_shares_write;
+	}
+	return 0;
+}
+__initcall(party_shares_init);
+
+/* /proc/party_wakeup_gran: see wakeup_preempt(), in ticks */
+static int party_wakeup_gran_read(char *page, char **start, off_t off,
+	int count, int *eof, void *data)
+{
+	*eof = 1;
+	return sprintf(page, "%d\n", party_wakeup_gran);
+}
+
+static int party_wakeup_gran_write(struct file *file, const char *buffer,
+	unsigned long count, void *data)
+{
+	char buf[16];
+	long gran;
+
+	if (!capable(CAP_SYS_NICE))
+		return -EPERM;
+	if (!count || count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, buffer, count))
+		return -EFAULT;
+	buf[count] = '\0';
+	gran = simple_strtol(buf, NULL, 0);
+	if (gran < 0 || gran > MAX_TIMESLICE)
+		return -EINVAL;
+	party_wakeup_gran = gran;
+	return count;
+}
+
+static int __init party_wakeup_gran_init(void)
+{
+	struct proc_dir_entry *entry;
+
+	entry = create_proc_entry("party_wakeup_gran", 0644, NULL);
+	if (entry) {
+		entry->read_proc = party_wakeup_gran_read;
+		entry->write_proc = party_wakeup_gran_write;
+	}
+	return 0;
+}
+__initcall(party_wakeup_gran_init);
+
+/*
+ * Scheduler trace: every context switch is recorded in a ring of the CPU
+ * it happens on. Only that CPU writes its ring, under its rq->lock, so the
+ * rings need no lock of their own; a reader may see an entry that is being
+ * overwritten. Off by default, costs one test in schedule() then.
+ * Read /proc/sched_trace, write 1 or 0 to it to turn tracing on or off.
+ */
+#define SCHED_TRACE_SIZE	256	/* entries per CPU, a power of 2 */
+
+#define TRACE_DEFAULT	0	/* the default O(1) pick */
+#define TRACE_PARTY	1	/* custom_pick_next() chose a party member */
+#define TRACE_GANG	2	/* our member of a gang slot */
+#define TRACE_IDLE	3	/* nothing to run */
+#define TRACE_YIELD	4	/* the target of sys_rpg_yield_to() */
+#define TRACE_REASONS	5
+
+struct sched_trace_entry {
+	cycles_t tsc;
+	pid_t prev, next, dflt;	/* dflt: what the default pick would have run */
+	unsigned short reason;
+	unsigned short nr_running;
+};
+
+struct sched_trace_ring {
+	unsigned int head;	/* entries written so far */
+	struct sched_trace_entry entry[SCHED_TRACE_SIZE];
+} ____cacheline_aligned;
+
+static struct sched_trace_ring sched_traces[NR_CPUS];
+static int sched_trace_on;
+
+static const char *sched_trace_reasons[TRACE_REASONS] = {
+	"default", "party", "gang", "idle", "yield"
+};
+
+static inline void sched_trace(runqueue_t *rq, task_t *prev, task_t *next,
+	task_t *dflt, int reason)
+{
+	struct sched_trace_ring *ring = sched_traces + smp_processor_id();
+	struct sched_trace_entry *e;
+
+	e = ring->entry + (ring->head++ & (SCHED_TRACE_SIZE - 1));
+	e->tsc = get_cycles();
+	e->prev = prev->pid;
+	e->next = next->pid;
+	e->dflt = dflt->pid;
+	e->reason = reason;
+	e->nr_running = rq->nr_running;
+}
+
+/* a header row, then every CPU owns SCHED_TRACE_SIZE rows. off is not a
+	byte count: it holds the row in its high bits and how much of that row
+	was read already in the low ones, so a reader with a small buffer gets a
+	row in pieces. we tell proc how far off moved through *start */
+#define SCHED_TRACE_SHIFT	8	/* a row is shorter than 1 << 8 */
+#define SCHED_TRACE_ROWS	(1 + smp_num_cpus * SCHED_TRACE_SIZE)
+
+/* print row into buf, returns its length, 0 for an entry never written */
+static int sched_trace_row(char *buf, int row)
+{
+	struct sched_trace_ring *ring;
+	struct sched_trace_entry e;
+	unsigned int cpu, i, head;
+
+	if (row == 0)
+		return sprintf(buf, "cpu tsc prev next default reason nr_running\n");
+	row--;
+	cpu = cpu_logical_map(row / SCHED_TRACE_SIZE);
+	ring = sched_traces + cpu;
+	head = ring->head;
+	i = row % SCHED_TRACE_SIZE;
+	//oldest first, skip entries never written
+	if (head < SCHED_TRACE_SIZE) {
+		if (i >= head)
+			return 0;
+	} else
+		i = (head + i) & (SCHED_TRACE_SIZE - 1);
+	e = ring->entry[i];
+	return sprintf(buf, "%u %llu %d %d %d %s %u\n", cpu,
+		(unsigned long long)e.tsc, e.prev, e.next, e.dflt,
+		e.reason < TRACE_REASONS ? sched_trace_reasons[e.reason] : "?",
+		e.nr_running);
+}
+
+static int sched_trace_read(char *page, char **start, off_t off,
+	int count, int *eof, void *data)
+{
+	int row = off >> SCHED_TRACE_SHIFT;
+	int skip = off & ((1 << SCHED_TRACE_SHIFT) - 1);
+	int len = 0, n;
+	char buf[1 << SCHED_TRACE_SHIFT];
+
+	for (; row < SCHED_TRACE_ROWS && len < count; row++, skip = 0) {
+		//the ring may have moved on since the first piece was read
+		n = sched_trace_row(buf, row) - skip;
+		if (n <= 0)
+			continue;
+		if (n > count - len) {
+			memcpy(page + len, buf + skip, count - len);
+			skip += count - len;
+			len = count;
+			break;
+		}
+		memcpy(page + len, buf + skip, n);
+		len += n;
+	}
+	if (row >= SCHED_TRACE_ROWS)
+		*eof = 1;
+	*start = (char *)(long)((((off_t)row << SCHED_TRACE_SHIFT) | skip) - off);
+	return len;
+}
+
+static int sched_trace_write(struct file *file, const char *buffer,
+	unsigned long count, void *data)
+{
+	char c;
+	int cpu;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	if (!count || get_user(c, buffer))
+		return -EFAULT;
+	if (c != '0' && c != '1')
+		return -EINVAL;
+	//a fresh trace every time it is turned on
+	if (c == '1' && !sched_trace_on)
+		for (cpu = 0; cpu < NR_CPUS; cpu++)
+			sched_traces[cpu].head = 0;
+	sched_trace_on = c - '0';
+	return count;
+}
+
+static int __init sched_trace_init(void)
+{
+	struct proc_dir_entry *entry;
+
+	entry = create_proc_entry("sched_trace", 0644, NULL);
+	if (entry) {
+		entry->read_proc = sched_trace_read;
+		entry->write_proc = sched_trace_write;
+	}
+	return 0;
+}
+__initcall(sched_trace_init);
+
+/*
+ * Wakeup latency: the time from try_to_wake_up() (or fork) until the task
+ * first gets the CPU, in TSC cycles. Per-CPU histograms split party
+ * members from other tasks, each party also keeps its own histogram.
+ * Read /proc/sched_latency, write 0 to it to clear the histograms.
+ */
+struct lat_hist {
+	unsigned long member[LAT_BUCKETS];
+	unsigned long other[LAT_BUCKETS];
+} ____cacheline_aligned;
+
+static struct lat_hist lat_hists[NR_CPUS];
+
+static inline int lat_bucket(cycles_t delta)
+{
+	unsigned long d;
+	int k = 0;
+
+	if ((unsigned long long)delta >> 32)
+		return LAT_BUCKETS - 1;
+	d = (unsigned long)delta;
+	while (d >>= 1)
+		k++;
+	return k;
+}
+
+/* next is about to run on this CPU, rq->lock is held */
+static inline void lat_account(task_t *next)
+{
+	struct lat_hist *h = lat_hists + smp_processor_id();
+	int k = lat_bucket(get_cycles() - next->wake_tsc);
+
+	next->wake_tsc = 0;
+	if (next->party_rq) {
+		h->member[k]++;
+		spin_lock(&next->party_rq->lock);
+		next->party_rq->lat[k]++;
+		spin_unlock(&next->party_rq->lock);
+	} else
+		h->other[k]++;
+}
+
+static int sched_latency_read(char *page, char **start, off_t off,
+	int count, int *eof, void *data)
+{
+	struct party_runqueue *prq;
+	unsigned long member, other;
+	list_t *pos;
+	int len, k, cpu;
+
+	len = sprintf(page, "log2(cycles) member other\n");
+	for (k = 0; k < LAT_BUCKETS; k++) {
+		member = other = 0;
+		for (cpu = 0; cpu < smp_num_cpus; cpu++) {
+			member += lat_hists[cpu_logical_map(cpu)].member[k];
+			other += lat_hists[cpu_logical_map(cpu)].other[k];
+		}
+		len += sprintf(page + len, "%2d %10lu %10lu\n", k, member, other);
+	}
+	//one line per party, only the buckets that were hit
+	len += sprintf(page + len, "party log2(cycles):count...\n");
+	spin_lock_irq(&party_rqs_lock);
+	list_for_each(pos, &party_rqs) {
+		prq = list_entry(pos, struct party_runqueue, all_list);
+		if (len > PAGE_SIZE - 16 * LAT_BUCKETS)
+			break;
+		len += sprintf(page + len, "%5d", prq->id);
+		for (k = 0; k < LAT_BUCKETS; k++)
+			if (prq->lat[k])
+				len += sprintf(page + len, " %d:%lu", k, prq->lat[k]);
+		len += sprintf(page + len, "\n");
+	}
+	spin_unlock_irq(&party_rqs_lock);
+	*eof = 1;
+	return len;
+}
+
+static int sched_latency_write(struct file *file, const char *buffer,
+	unsigned long count, void *data)
+{
+	struct party_runqueue *prq;
+	list_t *pos;
+	char c;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	if (!count || get_user(c, buffer))
+		return -EFAULT;
+	if (c != '0')
+		return -EINVAL;
+	//racy against CPUs that account right now, good enough for statistics
+	memset(lat_hists, 0, sizeof(lat_hists));
+	spin_lock_irq(&party_rqs_lock);
+	list_for_each(pos, &party_rqs) {
+		prq = list_entry(pos, struct party_runqueue, all_list);
+		memset(prq->lat, 0, sizeof(prq->lat));
+	}
+	spin_unlock_irq(&party_rqs_lock);
+	return count;
+}
+
+static int __init sched_latency_init(void)
+{
+	struct proc_dir_entry *entry;
+
+	entry = create_proc_entry("sched_latency", 0644, NULL);
+	if (entry) {
+		entry->read_proc = sched_latency_read;
+		entry->write_proc = sched_latency_write;
+	}
+	return 0;
+}
+__initcall(sched_latency_init);
+
+/* turn gang scheduling of the caller's party on or off (RPG_GANG_QUERY
+	changes nothing) and optionally read the party's gang statistics.
+	gang slots IPI other CPUs, so turning it on needs CAP_SYS_NICE */
+int sys_rpg_gang(int mode, struct rpg_gang_stats *stats)
+{
+	struct party_runqueue *prq = current->party_rq;
+	struct rpg_gang_stats st;
+
+	if (!prq)
+		return -EINVAL;
+	if (mode != RPG_GANG_QUERY && mode != RPG_GANG_OFF && mode != RPG_GANG_ON)
+		return -EINVAL;
+	if (mode == RPG_GANG_ON && !capable(CAP_SYS_NICE))
+		return -EPERM;
+	spin_lock_irq(&prq->lock);
+	if (mode != RPG_GANG_QUERY && prq->gang != mode) {
+		prq->gang = mode;
+		prq->gang_expires = jiffies;
+	}
+	st.gang = prq->gang;
+	st.slots = prq->gang_slots;
+	st.ipis = prq->gang_ipis;
+	st.ticks = prq->gang_ticks;
+	st.full_ticks = prq->gang_full_ticks;
+	spin_unlock_irq(&prq->lock);
+	if (stats && copy_to_user(stats, &st, sizeof(st)))
+		return -EFAULT;
+	return 0;
+}
+
+/*
+ * Directed yield: give the rest of our time slice to a member of our party,
+ * pid, or to the best runnable member when pid is 0, and switch to it
+ * right away through rq->yield_to. Members are packed on their party's
+ * home CPU so the target is usually queued here already, a member waiting
+ * on another CPU is pulled over when its affinity allows.
+ * An expired target runs before the array switch, like a boosted member,
+ * so its slice is paid from the party's boost budget and it is refused
+ * (-EAGAIN) when the budget is short or the expired tasks here starve.
+ * Otherwise two members yielding to each other would starve them.
+ * Returns the pid of the member that got the CPU.
+ */
+int sys_rpg_yield_to(pid_t pid)
+{
+	struct party_runqueue *prq = current->party_rq;
+	runqueue_t *rq, *p_rq;
+	int this_cpu, retval;
+	task_t *p;
+
+	if (!prq)
+		return -EINVAL;
+	if (pid < 0 || pid == current->pid)
+		return -EINVAL;
+
+	read_lock_irq(&tasklist_lock);
+	this_cpu = smp_processor_id();
+	rq = this_rq();
+	if (pid) {
+		retval = -ESRCH;
+		p = find_task_by_pid(pid);
+		if (!p)
+			goto out_unlock_tasklist;
+repeat_lock:
+		p_rq = task_rq(p);
+		double_rq_lock(rq, p_rq);
+		if (unlikely(task_rq(p) != p_rq)) {
+			double_rq_unlock(rq, p_rq);
+			goto repeat_lock;
+		}
+	} else {
+		//a bitmap search of the party, not a runqueue scan
+		p_rq = rq;
+		spin_lock(&rq->lock);
+		p = party_best_on_cpu(prq, current, this_cpu, rq->active);
+		if (!p && !EXPIRED_STARVING(rq))
+			p = party_best_on_cpu(prq, current, this_cpu, rq->expired);
+		retval = -ESRCH;
+		if (!p)
+			goto out_unlock;
 	}
-	//printk(KERN_INFO "#############IM CHOSE MEMBER WITH PID %d\n",next_task->pid);
-	return next_task;	
+
+	retval = -EPERM;
+	if (p->party_rq != prq)
+		goto out_unlock;
+	retval = -EAGAIN;
+	if (!p->array)
+		goto out_unlock;
+	//it already has a CPU, there is nothing to hand over
+	retval = -EBUSY;
+	if (p_rq->curr == p)
+		goto out_unlock;
+#if CONFIG_SMP
+	retval = -EXDEV;
+	if ((p_rq != rq) && !(p->cpus_allowed & (1UL << this_cpu)))
+		goto out_unlock;
+#endif
+	if (p->array == p_rq->expired) {
+		retval = -EAGAIN;
+		if (EXPIRED_STARVING(rq))
+			goto out_unlock;
+		spin_lock(&prq->lock);
+		if (prq->boost_left < p->time_slice) {
+			spin_unlock(&prq->lock);
+			goto out_unlock;
+		}
+		prq->boost_left -= p->time_slice;
+		spin_unlock(&prq->lock);
+	}
+	if (p_rq != rq) {
+#if CONFIG_SMP
+		pull_task(p, p_rq, rq, this_cpu);
+#endif
+	} else if (p->array != rq->active) {
+		//the boost budget paid for its early turn
+		dequeue_task(p, p->array);
+		enqueue_task(p, rq->active);
+	}
+	if (current->time_slice > 1) {
+		p->time_slice += current->time_slice - 1;
+		if (p->time_slice > MAX_TIMESLICE)
+			p->time_slice = MAX_TIMESLICE;
+		current->time_slice = 1;
+	}
+	rq->yield_to = p;
+	retval = p->pid;
+
+out_unlock:
+	double_rq_unlock(rq, p_rq);
+out_unlock_tasklist:
+	read_unlock_irq(&tasklist_lock);
+	if (retval > 0)
+		schedule();
+	return retval;
+}
+
+/* allocate a party runqueue, the caller holds the only reference */
+struct party_runqueue *sched_alloc_party_rq(void)
+{
+	struct party_runqueue *prq;
+	int cpu = smp_processor_id();
+
+	prq = kmalloc(sizeof(struct party_runqueue), GFP_KERNEL);
+	if (!prq)
+		return NULL;
+	memset(prq->cpus, 0, sizeof(prq->cpus));
+	//the creator is queued here next, the other CPUs come when used
+	prq->cpus[cpu] = party_cpu_alloc(GFP_KERNEL);
+	if (!prq->cpus[cpu]) {
+		kfree(prq);
+		return NULL;
+	}
+	spin_lock_init(&prq->lock);
+	atomic_set(&prq->count, 1);
+	prq->nr_running = 0;
+	prq->home_cpu = cpu;
+	prq->gang = RPG_GANG_OFF;
+	prq->gang_expires = jiffies;
+	atomic_set(&prq->nr_on_cpu, 0);
+	prq->gang_slots = prq->gang_ipis = 0;
+	prq->gang_ticks = prq->gang_full_ticks = 0;
+	prq->round_expires = jiffies;
+	prq->ticks = 0;
+	prq->boost_left = PARTY_BOOST_LIMIT;
+	prq->boost_ticks = 0;
+	memset(prq->lat, 0, sizeof(prq->lat));
+
+	spin_lock_irq(&party_rqs_lock);
+	prq->id = ++party_next_id;
+	list_add_tail(&prq->all_list, &party_rqs);
+	spin_unlock_irq(&party_rqs_lock);
+	return prq;
+}
+
+/* may be called with a runqueue locked, so party_rqs_lock is irq safe */
+void sched_put_party_rq(struct party_runqueue *prq)
+{
+	unsigned long flags;
+	int cpu;
+
+	if (prq && atomic_dec_and_test(&prq->count)) {
+		spin_lock_irqsave(&party_rqs_lock, flags);
+		list_del(&prq->all_list);
+		spin_unlock_irqrestore(&party_rqs_lock, flags);
+		for (cpu = 0; cpu < NR_CPUS; cpu++)
+			if (prq->cpus[cpu])
+				kfree(prq->cpus[cpu]);
+		kfree(prq);
+	}
+}
+
+/* a reference to p's party runqueue, NULL if p has none (anymore).
+	sched_set_party_rq() changes p->party_rq under p's runqueue lock, so
+	taking the reference under it can not race with the last put */
+struct party_runqueue *sched_get_party_rq(task_t *p)
+{
+	struct party_runqueue *prq;
+	unsigned long flags;
+	runqueue_t *rq;
+
+	rq = task_rq_lock(p, &flags);
+	prq = p->party_rq;
+	if (prq)
+		atomic_inc(&prq->count);
+	task_rq_unlock(rq, &flags);
+	return prq;
+}
+
+/* move p to another party runqueue (NULL when it leaves its party),
+	keeping its place there if it is runnable */
+void sched_set_party_rq(task_t *p, struct party_runqueue *prq)
+{
+	struct party_runqueue *old;
+	unsigned long flags;
+	runqueue_t *rq;
+
+	if (prq)
+		atomic_inc(&prq->count);
+	rq = task_rq_lock(p, &flags);
+	old = p->party_rq;
+	if (p->array)
+		party_dequeue(p, p->array);
+	if (old && (rq->curr == p))
+		atomic_dec(&old->nr_on_cpu);
+	p->party_rq = prq;
+	if (prq && (rq->curr == p))
+		atomic_inc(&prq->nr_on_cpu);
+	if (p->array)
+		party_enqueue(p, p->array);
+	task_rq_unlock(rq, &flags);
+	sched_put_party_rq(old);
 }
 
 int check_has_character(task_t* proc){
@@ -958,11 +2038,11 @@ int get_expired_member_prio(task_t* leader,runqueue_t* rq){
  */
 asmlinkage void schedule(void)
 {
-	task_t *prev, *next;
+	task_t *prev, *next, *next_task, *dflt;
 	runqueue_t *rq;
 	prio_array_t *array;
 	list_t *queue;
-	int idx;
+	int idx, reason;
 
 	if (unlikely(in_interrupt()))
 		BUG();
@@ -996,8 +2076,9 @@ pick_next_task:
 		if (rq->nr_running)
 			goto pick_next_task;
 #endif
-		next = rq->idle;
+		next = dflt = rq->idle;
 		rq->expired_timestamp = 0;
+		reason = TRACE_IDLE;
 		goto switch_tasks;
 	}
 
@@ -1015,21 +2096,45 @@ pick_next_task:
 	idx = sched_find_first_bit(array->bitmap);
 	queue = array->queue + idx;	
 	next = list_entry(queue->next, task_t, run_list); // this will be my default setting
-	
-
-	if(check_has_character(current)){
-		//get the lowest running task
-		task_t * next_task = custom_pick_next(current);
-		if(next_task->state == TASK_RUNNING){
-			if(next_task->array != current->array){
-				//task is in expired, add to active array
-				dequeue_task(next_task, next_task->array);
-				enqueue_task(next_task, rq->active);
-			}
-			//printk(KERN_INFO "#############MY NEXT IS WITH PID %d INSTEAD OF %d\n",next_task->pid, next->pid);
+	dflt = next;
+	reason = TRACE_DEFAULT;
+
+	next_task = NULL;
+	//a directed yield named the next task, it is still queued here
+	if(unlikely(rq->yield_to != NULL)){
+		next_task = rq->yield_to;
+		rq->yield_to = NULL;
+		//like the party pick, it does not pass an RT task or a better
+		//priority that woke up here since. the hint is dropped then
+		if(rt_task(next) || next_task->prio > next->prio)
+			next_task = NULL;
+		else
+			reason = TRACE_YIELD;
+	}
+#if CONFIG_SMP
+	//a gang slot started on another CPU, run our member of that party
+	if(next_task == NULL && unlikely(rq->gang != NULL)){
+		next_task = gang_pick_next(rq);
+		//the slot may not pass an RT task or a better priority, nothing
+		//preempts the member on tick for the rest of the slot
+		if(next_task && (rt_task(next) || next_task->prio > next->prio))
+			next_task = NULL;
+		else
+			reason = TRACE_GANG;
+	}
+#endif
+	if(next_task != NULL){
+		next = next_task;
+	}else if(check_has_character(current)){
+		//get the lowest running task in the active array. it wins ties with the
+		//default pick, the party boost already made it better if it may be.
+		//expired members wait for the array switch like everyone else
+		next_task = custom_pick_next(current);
+		if(next_task && next_task != prev &&
+				next_task->array == rq->active && next_task->prio <= next->prio){
 			next = next_task;
+			reason = TRACE_PARTY;
 		}
-		
 	}
 	
 	
@@ -1038,8 +2143,20 @@ switch_tasks:
 	clear_tsk_need_resched(prev);
 
 	if (likely(prev != next)) {
+		if (unlikely(sched_trace_on))
+			sched_trace(rq, prev, next, dflt, reason);
+		if (next->wake_tsc)
+			lat_account(next);
 		rq->nr_switches++;
 		rq->curr = next;
+		rq->curr_timestamp = jiffies;
+		if (prev->party_rq)
+			atomic_dec(&prev->party_rq->nr_on_cpu);
+		if (next->party_rq) {
+			atomic_inc(&next->party_rq->nr_on_cpu);
+			if (unlikely(next->party_rq->gang))
+				gang_start(next);
+		}
 	
 		prepare_arch_switch(rq);
 		prev = context_switch(prev, next);
@@ -1568,8 +2685,11 @@ asmlinkage long sys_sched_yield(void)
 
 	if (i == MAX_PRIO || i <= current->prio)
 		i = current->prio;
-	else
+	else {
+		party_dequeue(current, array);
 		current->prio = i;
+		party_enqueue(current, array);
+	}
 
 	list_add(&current->run_list, array->queue[i].next);
 	__set_bit(i, array->bitmap);
@@ -1801,6 +2921,8 @@ void __init sched_init(void)
 		rq->expired = rq->arrays + 1;
 		spin_lock_init(&rq->lock);
 		INIT_LIST_HEAD(&rq->migration_queue);
+		rq->gang = NULL;
+		rq->yield_to = NULL;
 
 		for (j = 0; j < 2; j++) {
 			array = rq->arrays + j;
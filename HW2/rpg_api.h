@@ -13,6 +13,20 @@ struct rpg_stats {
 	int mage_levels;
 };
 
+/* gang scheduling modes for rpg_gang */
+#define RPG_GANG_QUERY -1
+#define RPG_GANG_OFF 0
+#define RPG_GANG_ON 1
+
+/* create rpg_gang_stats struct */
+struct rpg_gang_stats {
+	int gang;
+	unsigned long slots;
+	unsigned long ipis;
+	unsigned long ticks;
+	unsigned long full_ticks;
+};
+
 
 /*rpg_create wrapper function*/
 int rpg_create_character(int cclass){
@@ -116,6 +130,62 @@ int rpg_join(pid_t player){
 	return res;	
 }
 
+/*rpg_gang wrapper function
+	turns gang scheduling of my party on or off, stats may be NULL.
+	turning it on needs CAP_SYS_NICE (EPERM) */
+int rpg_gang(int mode, struct rpg_gang_stats* stats){
+	int res;
+	__asm__
+	(
+		"pushl %%eax;"
+		"pushl %%ebx;"
+		"pushl %%ecx;"
+		"movl $247, %%eax;"
+		"movl %1, %%ebx;"
+		"movl %2, %%ecx;"
+		"int $0x80;"
+		"movl %%eax,%0;"
+		"popl %%ecx;"
+		"popl %%ebx;"
+		"popl %%eax;"
+		: "=m" (res)
+		: "m" (mode), "m" (stats)
+	);
+	if (res < 0)
+	{
+		errno = -res;
+		res = -1;
+	}
+	return res;
+}
+
+/*rpg_yield_to wrapper function
+	gives the rest of my time slice to party member pid, or to the best
+	runnable member when pid is 0. returns the pid that got the CPU.
+	EAGAIN: the member waits for the array switch and the party's boost
+	can not pay for its early turn, or the tasks it would pass starve */
+int rpg_yield_to(pid_t pid){
+	int res;
+	__asm__
+	(
+		"pushl %%eax;"
+		"pushl %%ebx;"
+		"movl $248, %%eax;"
+		"movl %1, %%ebx;"
+		"int $0x80;"
+		"movl %%eax,%0;"
+		"popl %%ebx;"
+		"popl %%eax;"
+		: "=m" (res)
+		: "m" (pid)
+	);
+	if (res < 0)
+	{
+		errno = -res;
+		res = -1;
+	}
+	return res;
+}
 
 
 
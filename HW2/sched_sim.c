@@ -0,0 +1,873 @@
+/*
+ * sched_sim.c - user-space simulator of the HW2 scheduler
+ *
+ * Mirrors the O(1) runqueues of kernel/sched.c together with our party
+ * changes (party runqueues, custom_pick_next(), the party boost, fair
+ * share mode, packing on wakeup and whole-party load balancing), and
+ * runs them over a synthetic workload one tick at a time, so policy
+ * changes can be tried without booting a kernel.
+ *
+ * It is a copy, not a shared build of sched.c: when you change a policy
+ * in the kernel change it here too. RT tasks, gang mode and the migration
+ * threads are not simulated.
+ *
+ * Build: gcc -O2 -Wall -o sched_sim sched_sim.c
+ * Run:   ./sched_sim [-c cpus] [-t ticks] [-f] [-g gran] [-n] < workload
+ *	-c	number of CPUs (default 1)
+ *	-t	ticks to run, HZ is 100 (default 6000)
+ *	-f	party fair share mode, as /proc/party_shares
+ *	-g	party wakeup preemption granularity in ticks, as
+ *		/proc/party_wakeup_gran (default 1)
+ *	-n	no party scheduling at all, the plain O(1) scheduler to
+ *		compare against
+ *
+ * Workload, one command per line, times and bursts in ticks:
+ *	task <name> <nice> <party> <start> <run> <sleep> [<run> <sleep>...]
+ *		a task that runs <run> ticks then sleeps <sleep> ticks,
+ *		cycling over its bursts. party 0 is no party, run 0 runs
+ *		forever.
+ *	join <tick> <name> <party>
+ *		the task moves to another party (0 leaves its party)
+ *	expect <metric> [<name>] <min> <max>
+ *		checked after the run, sched_sim exits 1 if the value is out
+ *		of [min, max]. metrics of the whole run: fairness, latency,
+ *		member_latency, other_latency, throughput. metrics of task
+ *		<name>: ran, lat_avg, lat_max
+ *	# comment
+ *
+ * Example, two chatty party members next to two CPU hogs, compare the
+ * output of ./sched_sim, ./sched_sim -n and ./sched_sim -f on it:
+ *	task a 0 1 0 2 6
+ *	task b 0 1 3 2 6
+ *	task hog1 0 0 0 0 0
+ *	task hog2 5 0 0 0 0
+ *
+ * workloads/ has the workloads we measure policy changes with, each says
+ * how to run it and what to compare.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* the scheduler constants of kernel/sched.c, for HZ = 100 */
+#define HZ			100
+#define MAX_RT_PRIO		100
+#define MAX_PRIO		(MAX_RT_PRIO + 40)
+#define NICE_TO_PRIO(nice)	(MAX_RT_PRIO + (nice) + 20)
+#define PRIO_TO_NICE(prio)	((prio) - MAX_RT_PRIO - 20)
+#define TASK_NICE(p)		PRIO_TO_NICE((p)->static_prio)
+#define USER_PRIO(p)		((p)-MAX_RT_PRIO)
+#define MAX_USER_PRIO		(USER_PRIO(MAX_PRIO))
+
+#define MIN_TIMESLICE		( 10 * HZ / 1000)
+#define MAX_TIMESLICE		(300 * HZ / 1000)
+#define PRIO_BONUS_RATIO	25
+#define INTERACTIVE_DELTA	2
+#define MAX_SLEEP_AVG		(2*HZ)
+#define STARVATION_LIMIT	(2*HZ)
+#define PARTY_BOOST		2
+#define PARTY_BOOST_LIMIT	(MAX_TIMESLICE)
+#define PARTY_ROUND		(HZ)
+#define PARTY_TIMESLICE		(MIN_TIMESLICE + \
+	((MAX_TIMESLICE - MIN_TIMESLICE) * 19 / 39))
+#define BUSY_REBALANCE_TICK	(HZ/4 ?: 1)
+#define CACHE_DECAY_TICKS	1
+#define PARTY_PULL_MAX		32
+
+#define SCALE(v1,v1_max,v2_max) \
+	(v1) * (v2_max) / (v1_max)
+#define DELTA(p) \
+	(SCALE(TASK_NICE(p), 40, MAX_USER_PRIO*PRIO_BONUS_RATIO/100) + \
+		INTERACTIVE_DELTA)
+#define TASK_INTERACTIVE(p) \
+	((p)->prio <= (p)->static_prio - DELTA(p))
+#define TASK_TIMESLICE(p) (MIN_TIMESLICE + \
+	((MAX_TIMESLICE - MIN_TIMESLICE) * (MAX_PRIO-1-(p)->static_prio)/39))
+#define EXPIRED_STARVING(rq) \
+		((rq)->expired_timestamp && \
+		(jiffies - (rq)->expired_timestamp >= \
+			STARVATION_LIMIT * ((rq)->nr_running) + 1))
+
+#define MAX_CPUS	32
+#define MAX_TASKS	256
+#define MAX_PARTIES	64
+#define MAX_BURSTS	16
+#define MAX_JOINS	256
+#define MAX_EXPECTS	64
+
+#define BITS_PER_LONG	(8 * sizeof(long))
+#define BITMAP_SIZE	((MAX_PRIO + 1 + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+/****** lists and bitmaps like the kernel's ******/
+typedef struct list_head {
+	struct list_head *next, *prev;
+} list_t;
+
+#define list_entry(ptr, type, member) \
+	((type *)((char *)(ptr) - (unsigned long)(&((type *)0)->member)))
+
+static void INIT_LIST_HEAD(list_t *head)
+{
+	head->next = head->prev = head;
+}
+
+static int list_empty(list_t *head)
+{
+	return head->next == head;
+}
+
+static void list_add_tail(list_t *new, list_t *head)
+{
+	new->prev = head->prev;
+	new->next = head;
+	head->prev->next = new;
+	head->prev = new;
+}
+
+static void list_del_init(list_t *entry)
+{
+	entry->prev->next = entry->next;
+	entry->next->prev = entry->prev;
+	INIT_LIST_HEAD(entry);
+}
+
+static void __set_bit(int nr, unsigned long *map)
+{
+	map[nr / BITS_PER_LONG] |= 1UL << (nr % BITS_PER_LONG);
+}
+
+static void __clear_bit(int nr, unsigned long *map)
+{
+	map[nr / BITS_PER_LONG] &= ~(1UL << (nr % BITS_PER_LONG));
+}
+
+/* the MAX_PRIO delimiter bit is always set, so this always finds one */
+static int find_next_bit(unsigned long *map, int start)
+{
+	int i = start / BITS_PER_LONG;
+	unsigned long word = map[i] & (~0UL << (start % BITS_PER_LONG));
+
+	while (!word)
+		word = map[++i];
+	return i * BITS_PER_LONG + __builtin_ctzl(word);
+}
+
+#define sched_find_first_bit(map) find_next_bit(map, 0)
+
+/****** the scheduler state ******/
+typedef struct prio_array {
+	int nr_active;
+	unsigned long bitmap[BITMAP_SIZE];
+	list_t queue[MAX_PRIO];
+} prio_array_t;
+
+struct party_runqueue {
+	int id;
+	int nr_running;
+	int home_cpu;
+	unsigned long round_expires;
+	int boost_left;
+	unsigned long ticks, boost_ticks;
+	unsigned long bitmap[BITMAP_SIZE];
+	list_t queue[MAX_PRIO];
+};
+
+typedef struct task {
+	char name[16];
+	int static_prio, prio;
+	unsigned long sleep_avg, sleep_timestamp;
+	int time_slice;
+	int cpu, last_cpu;	/* last_cpu: where it last ran, -1 before that */
+	int party;		/* the workload's party, also with -n */
+	int sleeping;
+	prio_array_t *array;
+	list_t run_list;
+	struct party_runqueue *party_rq;
+	list_t party_run_list;
+
+	int bursts[MAX_BURSTS][2];
+	int nr_bursts, burst, burst_left;
+	unsigned long start, wake_at;
+	long wake_tick;		/* when we were woken, -1 once we ran */
+
+	unsigned long ran, bursts_done, wakeups, lat_sum, lat_max;
+} task_t;
+
+typedef struct runqueue {
+	int nr_running;
+	unsigned long nr_switches, expired_timestamp;
+	unsigned long curr_timestamp;
+	task_t *curr;		/* NULL is the idle task */
+	int need_resched;
+	prio_array_t *active, *expired, arrays[2];
+	unsigned long idle_ticks;
+	int last_party;		/* workload party of the last task that ran here */
+	unsigned long migrations, party_switches;
+} runqueue_t;
+
+static runqueue_t runqueues[MAX_CPUS];
+static task_t tasks[MAX_TASKS];
+static struct party_runqueue parties[MAX_PARTIES + 1];
+static struct { unsigned long tick; task_t *p; int party; } joins[MAX_JOINS];
+static struct { char metric[16]; task_t *p; double min, max; } expects[MAX_EXPECTS];
+static int nr_cpus = 1, nr_tasks, nr_joins, nr_expects;
+/* what report() printed, for the expect lines */
+static double fairness, latency, member_latency, other_latency, throughput;
+static int party_fair, party_sched = 1, party_wakeup_gran = MIN_TIMESLICE;
+static unsigned long jiffies;
+
+#define cpu_rq(cpu)	(runqueues + (cpu))
+#define task_rq(p)	cpu_rq((p)->cpu)
+
+static void init_prio_array(unsigned long *bitmap, list_t *queue)
+{
+	int k;
+
+	memset(bitmap, 0, BITMAP_SIZE * sizeof(long));
+	for (k = 0; k < MAX_PRIO; k++)
+		INIT_LIST_HEAD(queue + k);
+	// delimiter for bitsearch
+	__set_bit(MAX_PRIO, bitmap);
+}
+
+/****** kernel/sched.c, reduced to what a tick based simulation needs ******/
+static void party_enqueue(task_t *p)
+{
+	struct party_runqueue *prq = p->party_rq;
+
+	if (!prq)
+		return;
+	list_add_tail(&p->party_run_list, prq->queue + p->prio);
+	__set_bit(p->prio, prq->bitmap);
+	prq->nr_running++;
+}
+
+static void party_dequeue(task_t *p)
+{
+	struct party_runqueue *prq = p->party_rq;
+
+	if (!prq || list_empty(&p->party_run_list))
+		return;
+	prq->nr_running--;
+	list_del_init(&p->party_run_list);
+	if (list_empty(prq->queue + p->prio))
+		__clear_bit(p->prio, prq->bitmap);
+}
+
+static void dequeue_task(task_t *p, prio_array_t *array)
+{
+	array->nr_active--;
+	list_del_init(&p->run_list);
+	if (list_empty(array->queue + p->prio))
+		__clear_bit(p->prio, array->bitmap);
+	party_dequeue(p);
+}
+
+static void enqueue_task(task_t *p, prio_array_t *array)
+{
+	list_add_tail(&p->run_list, array->queue + p->prio);
+	__set_bit(p->prio, array->bitmap);
+	array->nr_active++;
+	p->array = array;
+	party_enqueue(p);
+}
+
+static int party_boost_ok(task_t *p)
+{
+	return (p->party_rq->boost_left > 0) && !EXPIRED_STARVING(task_rq(p));
+}
+
+static int effective_prio(task_t *p)
+{
+	int bonus, prio;
+
+	bonus = MAX_USER_PRIO*PRIO_BONUS_RATIO*p->sleep_avg/MAX_SLEEP_AVG/100 -
+			MAX_USER_PRIO*PRIO_BONUS_RATIO/100/2;
+	prio = p->static_prio - bonus;
+	if (p->party_rq && party_boost_ok(p))
+		prio -= PARTY_BOOST;
+	if (prio < MAX_RT_PRIO)
+		prio = MAX_RT_PRIO;
+	if (prio > MAX_PRIO-1)
+		prio = MAX_PRIO-1;
+	return prio;
+}
+
+static void activate_task(task_t *p, runqueue_t *rq)
+{
+	unsigned long sleep_time = jiffies - p->sleep_timestamp;
+
+	if (sleep_time) {
+		p->sleep_avg += sleep_time;
+		if (p->sleep_avg > MAX_SLEEP_AVG)
+			p->sleep_avg = MAX_SLEEP_AVG;
+		p->prio = effective_prio(p);
+	}
+	enqueue_task(p, rq->active);
+	rq->nr_running++;
+}
+
+static void deactivate_task(task_t *p, runqueue_t *rq)
+{
+	rq->nr_running--;
+	dequeue_task(p, p->array);
+	p->array = NULL;
+}
+
+/* the running task of a CPU, as a priority, the idle task is the worst */
+static int curr_prio(runqueue_t *rq)
+{
+	return rq->curr ? rq->curr->prio : MAX_PRIO;
+}
+
+static void wakeup_preempt(task_t *p, runqueue_t *rq)
+{
+	task_t *curr = rq->curr;
+
+	if (p->prio < curr_prio(rq))
+		rq->need_resched = 1;
+	else if (p->party_rq && (p->party_rq == curr->party_rq) &&
+			(p->prio == curr->prio) && (p->array == rq->active) &&
+			(jiffies - rq->curr_timestamp >= party_wakeup_gran))
+		rq->need_resched = 1;
+}
+
+static void try_to_wake_up(task_t *p)
+{
+	runqueue_t *rq;
+
+	//party members are packed onto their party's home CPU, unless it
+	//is busier than the CPU they wake on
+	if (p->party_rq &&
+			cpu_rq(p->party_rq->home_cpu)->nr_running <= task_rq(p)->nr_running)
+		p->cpu = p->party_rq->home_cpu;
+	rq = task_rq(p);
+	p->sleeping = 0;
+	activate_task(p, rq);
+	wakeup_preempt(p, rq);
+	p->wakeups++;
+	p->wake_tick = jiffies;
+}
+
+/* the best runnable member of a party queued on cpu in array, other than skip */
+static task_t *party_best_on_cpu(struct party_runqueue *prq, task_t *skip,
+	int cpu, prio_array_t *array)
+{
+	list_t *pos;
+	task_t *task;
+	int idx;
+
+	for (idx = sched_find_first_bit(prq->bitmap); idx < MAX_PRIO;
+			idx = find_next_bit(prq->bitmap, idx + 1))
+		for (pos = prq->queue[idx].next; pos != prq->queue + idx; pos = pos->next) {
+			task = list_entry(pos, task_t, party_run_list);
+			if (task != skip && task->cpu == cpu && task->array == array)
+				return task;
+		}
+	return NULL;
+}
+
+static task_t *custom_pick_next(task_t *curr)
+{
+	task_t *next_task = NULL;
+
+	if (curr->party_rq)
+		next_task = party_best_on_cpu(curr->party_rq, curr, curr->cpu,
+			task_rq(curr)->active);
+	return next_task;
+}
+
+static void pull_task(task_t *p, runqueue_t *src, runqueue_t *this_rq, int this_cpu)
+{
+	dequeue_task(p, p->array);
+	src->nr_running--;
+	p->cpu = this_cpu;
+	this_rq->nr_running++;
+	enqueue_task(p, this_rq->active);
+	if (p->prio < curr_prio(this_rq))
+		this_rq->need_resched = 1;
+}
+
+#define CAN_MIGRATE_TASK(p,rq) \
+	((jiffies - (p)->sleep_timestamp > CACHE_DECAY_TICKS) && ((p) != (rq)->curr))
+
+/* the kernel's load_balance() without the prev_nr_running smoothing */
+static void load_balance(int this_cpu, int idle)
+{
+	runqueue_t *this_rq = cpu_rq(this_cpu), *busiest = NULL;
+	task_t *members[PARTY_PULL_MAX], *tmp;
+	int imbalance, max_load = 1, i, n, idx;
+	prio_array_t *array;
+	list_t *head, *curr;
+
+	for (i = 0; i < nr_cpus; i++)
+		if (i != this_cpu && cpu_rq(i)->nr_running > max_load) {
+			busiest = cpu_rq(i);
+			max_load = busiest->nr_running;
+		}
+	if (!busiest)
+		return;
+	imbalance = (max_load - this_rq->nr_running) / 2;
+	if (!idle && (imbalance < (max_load + 3)/4))
+		return;
+	if (busiest->nr_running <= this_rq->nr_running + 1)
+		return;
+
+restart:
+	array = busiest->expired->nr_active ? busiest->expired : busiest->active;
+	for (;;) {
+		for (idx = sched_find_first_bit(array->bitmap); idx < MAX_PRIO;
+				idx = find_next_bit(array->bitmap, idx + 1)) {
+			head = array->queue + idx;
+			for (curr = head->prev; curr != head; ) {
+				tmp = list_entry(curr, task_t, run_list);
+				curr = curr->prev;
+				if (!CAN_MIGRATE_TASK(tmp, busiest))
+					continue;
+				if (!tmp->party_rq) {
+					pull_task(tmp, busiest, this_rq, this_cpu);
+					if (idle || !--imbalance)
+						return;
+					continue;
+				}
+				//the whole party moves, unless it is bigger than the imbalance
+				n = 0;
+				for (i = 0; i < nr_tasks && n < PARTY_PULL_MAX; i++)
+					if (tasks[i].party_rq == tmp->party_rq &&
+							tasks[i].array && task_rq(tasks + i) == busiest)
+						members[n++] = tasks + i;
+				if (!idle && (n > imbalance))
+					continue;
+				//tmp can migrate, so every restart pulls at least tmp
+				pull_task(tmp, busiest, this_rq, this_cpu);
+				imbalance--;
+				for (i = 0; i < n; i++)
+					if (members[i] != tmp && CAN_MIGRATE_TASK(members[i], busiest)) {
+						pull_task(members[i], busiest, this_rq, this_cpu);
+						imbalance--;
+					}
+				tmp->party_rq->home_cpu = this_cpu;
+				if (!idle && (imbalance > 0))
+					goto restart;
+				return;
+			}
+		}
+		if (array == busiest->active)
+			return;
+		array = busiest->active;
+	}
+}
+
+static void party_charge(task_t *p)
+{
+	struct party_runqueue *prq = p->party_rq;
+
+	prq->ticks++;
+	if (jiffies >= prq->round_expires) {
+		prq->round_expires = jiffies + PARTY_ROUND;
+		prq->boost_left = PARTY_BOOST_LIMIT;
+	}
+	if (prq->boost_left > 0) {
+		prq->boost_left--;
+		prq->boost_ticks++;
+	}
+}
+
+static unsigned int party_member_slice(task_t *p)
+{
+	int nr = p->party_rq->nr_running;
+	unsigned int slice = PARTY_TIMESLICE;
+
+	if (nr > 1)
+		slice /= nr;
+	return slice ? slice : 1;
+}
+
+static void scheduler_tick(int cpu)
+{
+	runqueue_t *rq = cpu_rq(cpu);
+	task_t *p = rq->curr;
+
+	if (!p) {
+		rq->idle_ticks++;
+		load_balance(cpu, 1);
+		return;
+	}
+	p->ran++;
+	//the workload: the current burst ran one more tick
+	if (p->burst_left > 0 && !--p->burst_left) {
+		p->bursts_done++;
+		p->sleeping = 1;
+		p->wake_at = jiffies + p->bursts[p->burst][1];
+		p->burst = (p->burst + 1) % p->nr_bursts;
+		rq->need_resched = 1;
+	}
+	if (p->array != rq->active) {
+		rq->need_resched = 1;
+		return;
+	}
+	if (p->sleep_avg)
+		p->sleep_avg--;
+	if (p->party_rq) {
+		party_charge(p);
+		if (party_fair && p->time_slice > party_member_slice(p))
+			p->time_slice = party_member_slice(p);
+	}
+	if (!--p->time_slice) {
+		dequeue_task(p, rq->active);
+		rq->need_resched = 1;
+		p->prio = effective_prio(p);
+		p->time_slice = TASK_TIMESLICE(p);
+		if (party_fair && p->party_rq)
+			p->time_slice = party_member_slice(p);
+		if (!TASK_INTERACTIVE(p) || EXPIRED_STARVING(rq) ||
+				(party_fair && p->party_rq)) {
+			if (!rq->expired_timestamp)
+				rq->expired_timestamp = jiffies;
+			enqueue_task(p, rq->expired);
+		} else
+			enqueue_task(p, rq->active);
+	}
+	if (!(jiffies % BUSY_REBALANCE_TICK))
+		load_balance(cpu, 0);
+}
+
+static void schedule(int cpu)
+{
+	runqueue_t *rq = cpu_rq(cpu);
+	task_t *prev = rq->curr, *next, *next_task;
+	prio_array_t *array;
+
+	rq->need_resched = 0;
+	if (prev) {
+		prev->sleep_timestamp = jiffies;
+		if (prev->sleeping)
+			deactivate_task(prev, rq);
+	}
+	if (!rq->nr_running) {
+		load_balance(cpu, 1);
+		if (!rq->nr_running) {
+			rq->expired_timestamp = 0;
+			next = NULL;
+			goto switch_tasks;
+		}
+	}
+	array = rq->active;
+	if (!array->nr_active) {
+		rq->active = rq->expired;
+		rq->expired = array;
+		array = rq->active;
+		rq->expired_timestamp = 0;
+	}
+	next = list_entry(array->queue[sched_find_first_bit(array->bitmap)].next,
+		task_t, run_list);
+	if (party_sched && prev && prev->party_rq) {
+		next_task = custom_pick_next(prev);
+		if (next_task && next_task != prev &&
+				next_task->array == rq->active && next_task->prio <= next->prio)
+			next = next_task;
+	}
+switch_tasks:
+	if (prev != next) {
+		rq->nr_switches++;
+		rq->curr = next;
+		rq->curr_timestamp = jiffies;
+		//cache locality: did next move, does it find its party's data here
+		if (next) {
+			if (next->last_cpu >= 0 && next->last_cpu != cpu)
+				rq->migrations++;
+			if (next->party && next->party == rq->last_party)
+				rq->party_switches++;
+			next->last_cpu = cpu;
+			rq->last_party = next->party;
+		}
+	}
+	if (next && next->wake_tick >= 0) {
+		unsigned long lat = jiffies - next->wake_tick;
+
+		next->lat_sum += lat;
+		if (lat > next->lat_max)
+			next->lat_max = lat;
+		next->wake_tick = -1;
+	}
+}
+
+/****** the workload ******/
+static struct party_runqueue *get_party(int id)
+{
+	struct party_runqueue *prq;
+
+	if (id <= 0)
+		return NULL;
+	if (id > MAX_PARTIES) {
+		fprintf(stderr, "party %d: at most %d parties\n", id, MAX_PARTIES);
+		exit(1);
+	}
+	prq = parties + id;
+	if (!prq->id) {
+		prq->id = id;
+		prq->home_cpu = (id - 1) % nr_cpus;
+		prq->boost_left = PARTY_BOOST_LIMIT;
+		init_prio_array(prq->bitmap, prq->queue);
+	}
+	return prq;
+}
+
+static task_t *find_task(const char *name)
+{
+	int i;
+
+	for (i = 0; i < nr_tasks; i++)
+		if (!strcmp(tasks[i].name, name))
+			return tasks + i;
+	return NULL;
+}
+
+/* a queued task leaves its party runqueue and enters the new one */
+static void set_party(task_t *p, int party)
+{
+	if (p->array)
+		party_dequeue(p);
+	p->party = party;
+	p->party_rq = party_sched ? get_party(party) : NULL;
+	if (p->array)
+		party_enqueue(p);
+}
+
+static void read_workload(FILE *f)
+{
+	char line[512], cmd[16], name[16], metric[16];
+	int nice, party, n, off, k;
+	unsigned long tick;
+	task_t *p;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%15s", cmd) != 1 || cmd[0] == '#')
+			continue;
+		if (!strcmp(cmd, "join")) {
+			if (nr_joins == MAX_JOINS ||
+					sscanf(line, "%*s %lu %15s %d", &tick, name, &party) != 3)
+				goto bad;
+			if (!(p = find_task(name)))
+				goto bad;
+			joins[nr_joins].tick = tick;
+			joins[nr_joins].p = p;
+			joins[nr_joins++].party = party;
+			continue;
+		}
+		if (!strcmp(cmd, "expect")) {
+			if (nr_expects == MAX_EXPECTS ||
+					sscanf(line, "%*s %15s%n", metric, &off) != 1)
+				goto bad;
+			p = NULL;
+			if (!strcmp(metric, "ran") || !strcmp(metric, "lat_avg") ||
+					!strcmp(metric, "lat_max")) {
+				if (sscanf(line + off, "%15s%n", name, &n) != 1 ||
+						!(p = find_task(name)))
+					goto bad;
+				off += n;
+			} else if (strcmp(metric, "fairness") && strcmp(metric, "latency") &&
+					strcmp(metric, "member_latency") &&
+					strcmp(metric, "other_latency") && strcmp(metric, "throughput"))
+				goto bad;
+			if (sscanf(line + off, "%lf %lf", &expects[nr_expects].min,
+					&expects[nr_expects].max) != 2)
+				goto bad;
+			strcpy(expects[nr_expects].metric, metric);
+			expects[nr_expects++].p = p;
+			continue;
+		}
+		if (strcmp(cmd, "task") || nr_tasks == MAX_TASKS)
+			goto bad;
+		p = tasks + nr_tasks;
+		if (sscanf(line, "%*s %15s %d %d %lu%n", p->name, &nice, &party,
+				&p->start, &off) != 4 || nice < -20 || nice > 19)
+			goto bad;
+		for (k = 0; k < MAX_BURSTS &&
+				sscanf(line + off, "%d %d%n", &p->bursts[k][0],
+					&p->bursts[k][1], &n) == 2; k++)
+			off += n;
+		if (!k)
+			goto bad;
+		p->nr_bursts = k;
+		p->static_prio = p->prio = NICE_TO_PRIO(nice);
+		p->time_slice = TASK_TIMESLICE(p);
+		p->sleeping = 1;
+		p->wake_tick = -1;
+		p->cpu = nr_tasks % nr_cpus;
+		p->last_cpu = -1;
+		p->party = party > 0 ? party : 0;
+		INIT_LIST_HEAD(&p->run_list);
+		INIT_LIST_HEAD(&p->party_run_list);
+		p->party_rq = party_sched ? get_party(party) : NULL;
+		nr_tasks++;
+		continue;
+bad:
+		fprintf(stderr, "bad workload line: %s", line);
+		exit(1);
+	}
+}
+
+/****** the report ******/
+static void report(void)
+{
+	unsigned long switches = 0, idle = 0, bursts = 0, busy = 0;
+	unsigned long migrations = 0, party_switches = 0;
+	unsigned long lat_sum = 0, wakeups = 0, member_lat = 0, member_wakeups = 0;
+	double sum = 0, sum2 = 0, share;
+	task_t *p;
+	int i;
+
+	for (i = 0; i < nr_cpus; i++) {
+		switches += cpu_rq(i)->nr_switches;
+		idle += cpu_rq(i)->idle_ticks;
+		migrations += cpu_rq(i)->migrations;
+		party_switches += cpu_rq(i)->party_switches;
+	}
+	printf("%-10s %5s %5s %8s %8s %8s %8s %8s\n", "task", "nice", "party",
+		"ran", "bursts", "wakeups", "lat_avg", "lat_max");
+	for (p = tasks; p < tasks + nr_tasks; p++) {
+		printf("%-10s %5d %5d %8lu %8lu %8lu %8.2f %8lu\n", p->name,
+			TASK_NICE(p), p->party_rq ? p->party_rq->id : 0, p->ran,
+			p->bursts_done, p->wakeups,
+			p->wakeups ? (double)p->lat_sum / p->wakeups : 0.0, p->lat_max);
+		bursts += p->bursts_done;
+		busy += p->ran;
+		lat_sum += p->lat_sum;
+		wakeups += p->wakeups;
+		if (p->party_rq) {
+			member_lat += p->lat_sum;
+			member_wakeups += p->wakeups;
+		}
+		//fairness: CPU time per unit of the time slice the task is entitled to
+		share = (double)p->ran / TASK_TIMESLICE(p);
+		sum += share;
+		sum2 += share * share;
+	}
+	printf("\n%-6s %8s %8s %8s\n", "party", "ticks", "share%", "boosted");
+	for (i = 1; i <= MAX_PARTIES; i++)
+		if (parties[i].id)
+			printf("%-6d %8lu %8.1f %8lu\n", i, parties[i].ticks,
+				busy ? 100.0 * parties[i].ticks / busy : 0.0,
+				parties[i].boost_ticks);
+	throughput = jiffies ? (double)bursts / jiffies : 0.0;
+	latency = wakeups ? (double)lat_sum / wakeups : 0.0;
+	member_latency = member_wakeups ? (double)member_lat / member_wakeups : 0.0;
+	other_latency = wakeups > member_wakeups ?
+		(double)(lat_sum - member_lat) / (wakeups - member_wakeups) : 0.0;
+	fairness = sum2 ? sum * sum / (nr_tasks * sum2) : 1.0;
+	printf("\nticks %lu cpus %d busy %lu idle %lu switches %lu\n",
+		jiffies, nr_cpus, busy, idle, switches);
+	printf("throughput %.3f bursts/tick\n", throughput);
+	printf("wakeup latency avg %.2f ticks, party members %.2f, others %.2f\n",
+		latency, member_latency, other_latency);
+	printf("fairness (Jain, 1 is fair) %.3f\n", fairness);
+	printf("locality: migrations %lu, switches within a party %lu of %lu\n",
+		migrations, party_switches, switches);
+}
+
+/* the expect lines of the workload, returns how many failed */
+static int check_expects(void)
+{
+	double value;
+	task_t *p;
+	int i, failed = 0;
+
+	for (i = 0; i < nr_expects; i++) {
+		p = expects[i].p;
+		if (!strcmp(expects[i].metric, "ran"))
+			value = p->ran;
+		else if (!strcmp(expects[i].metric, "lat_avg"))
+			value = p->wakeups ? (double)p->lat_sum / p->wakeups : 0.0;
+		else if (!strcmp(expects[i].metric, "lat_max"))
+			value = p->lat_max;
+		else if (!strcmp(expects[i].metric, "fairness"))
+			value = fairness;
+		else if (!strcmp(expects[i].metric, "latency"))
+			value = latency;
+		else if (!strcmp(expects[i].metric, "member_latency"))
+			value = member_latency;
+		else if (!strcmp(expects[i].metric, "other_latency"))
+			value = other_latency;
+		else
+			value = throughput;
+		if (value >= expects[i].min && value <= expects[i].max)
+			continue;
+		printf("expect %s%s%s %g %g failed: %g\n", expects[i].metric,
+			p ? " " : "", p ? p->name : "", expects[i].min, expects[i].max, value);
+		failed++;
+	}
+	if (nr_expects)
+		printf("expect: %d of %d failed\n", failed, nr_expects);
+	return failed;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long ticks = 6000;
+	runqueue_t *rq;
+	task_t *p;
+	int c, i;
+
+	while ((c = getopt(argc, argv, "c:t:fg:n")) != -1) {
+		switch (c) {
+		case 'c':
+			nr_cpus = atoi(optarg);
+			if (nr_cpus < 1 || nr_cpus > MAX_CPUS) {
+				fprintf(stderr, "1 to %d CPUs\n", MAX_CPUS);
+				return 1;
+			}
+			break;
+		case 't':
+			ticks = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			party_fair = 1;
+			break;
+		case 'g':
+			party_wakeup_gran = atoi(optarg);
+			break;
+		case 'n':
+			party_sched = 0;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-c cpus] [-t ticks] [-f] [-g gran] [-n] < workload\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	for (i = 0; i < nr_cpus; i++) {
+		rq = cpu_rq(i);
+		rq->active = rq->arrays;
+		rq->expired = rq->arrays + 1;
+		init_prio_array(rq->arrays[0].bitmap, rq->arrays[0].queue);
+		init_prio_array(rq->arrays[1].bitmap, rq->arrays[1].queue);
+	}
+	read_workload(stdin);
+
+	for (jiffies = 0; jiffies < ticks; jiffies++) {
+		for (i = 0; i < nr_joins; i++)
+			if (joins[i].tick == jiffies)
+				set_party(joins[i].p, joins[i].party);
+		//wakeups first, then every CPU runs one tick and reschedules
+		for (p = tasks; p < tasks + nr_tasks; p++) {
+			if (!p->sleeping || p->array)
+				continue;
+			if (jiffies < p->start || (p->wakeups && jiffies < p->wake_at))
+				continue;
+			p->burst_left = p->bursts[p->burst][0];
+			try_to_wake_up(p);
+		}
+		for (i = 0; i < nr_cpus; i++) {
+			rq = cpu_rq(i);
+			if (rq->need_resched || !rq->curr)
+				schedule(i);
+			scheduler_tick(i);
+			if (rq->need_resched)
+				schedule(i);
+		}
+	}
+	report();
+	return check_expects() ? 1 : 0;
+}
@@ -0,0 +1,119 @@
+/*
+ * fork_bench.c - fork rate with many live tasks
+ *
+ * get_pid() used to rescan the task list whenever last_pid reached the
+ * next pid in use, which with many live tasks is almost every fork. This
+ * keeps <live> children asleep, so the pid space is crowded, and then
+ * times fork() + _exit() + waitpid() of short lived children.
+ *
+ * Build: gcc -O2 -Wall -o fork_bench fork_bench.c
+ * Run:   ./fork_bench [-n forks] [live...]
+ *	default live counts 1000 10000 30000. 30000 live tasks need root
+ *	or a high ulimit -u, and a pid space (PID_MAX) of 32768 leaves
+ *	get_pid() very few free ids, which is the case we care about.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#define MAX_LIVE 32000
+
+static pid_t live[MAX_LIVE];
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* park nr children in pause(), returns how many we got */
+static int spawn_live(int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		live[i] = fork();
+		if (live[i] == 0) {
+			pause();
+			_exit(0);
+		}
+		if (live[i] < 0) {
+			perror("fork of a live task");
+			break;
+		}
+	}
+	return i;
+}
+
+static void kill_live(int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		kill(live[i], SIGKILL);
+	while (wait(NULL) > 0)
+		;
+}
+
+static int bench(int nr_live, long forks)
+{
+	double start, secs;
+	long i;
+	pid_t pid;
+	int got;
+
+	got = spawn_live(nr_live);
+	if (got < nr_live) {
+		kill_live(got);
+		return 1;
+	}
+	start = now();
+	for (i = 0; i < forks; i++) {
+		pid = fork();
+		if (pid == 0)
+			_exit(0);
+		if (pid < 0) {
+			perror("fork");
+			break;
+		}
+		waitpid(pid, NULL, 0);
+	}
+	secs = now() - start;
+	printf("%6d live %8ld forks %10.0f forks/s %8.2f us/fork\n", nr_live, i,
+		i / secs, secs * 1e6 / (i ? i : 1));
+	kill_live(got);
+	return i < forks;
+}
+
+int main(int argc, char **argv)
+{
+	static int defaults[] = { 1000, 10000, 30000 };
+	long forks = 100000;
+	int c, i, nr, failed = 0;
+
+	while ((c = getopt(argc, argv, "n:")) != -1) {
+		if (c != 'n' || (forks = atol(optarg)) <= 0) {
+			fprintf(stderr, "usage: %s [-n forks] [live...]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (optind == argc) {
+		for (i = 0; i < 3; i++)
+			failed |= bench(defaults[i], forks);
+		return failed;
+	}
+	for (i = optind; i < argc; i++) {
+		nr = atoi(argv[i]);
+		if (nr < 0 || nr > MAX_LIVE) {
+			fprintf(stderr, "0 to %d live tasks\n", MAX_LIVE);
+			return 1;
+		}
+		failed |= bench(nr, forks);
+	}
+	return failed;
+}
@@ -10,6 +10,10 @@
 #include <asm/uaccess.h>
 #include <asm/current.h>
 #include <linux/fs.h>
+#include <linux/spinlock.h>
+#include <asm/atomic.h>
+#include <asm/page.h>
+#include <asm/bitops.h>
 
 
 
@@ -25,36 +29,139 @@ struct rpg_stats{
 	int mage_levels;
 };
 
+/* one encounter of sys_rpg_fight_batch */
+struct rpg_encounter{
+	int type;
+	int level;
+};
+
+/* one member in the roster of sys_rpg_roster */
+struct rpg_member{
+	pid_t pid;
+	int cclass;
+	int level;
+	int leader;	/* 1 for the party leader */
+};
+
+/* bounds of the class and creature numbers, see sys_rpg_set_weights() */
+#define RPG_MAX_CLASSES 8
+#define RPG_MAX_CREATURES 8
+
+/* RPG trace events, read as binary struct rpg_trace_event records from
+	/dev/rpg_trace. arg[] per event:
+	CREATE cclass | FIGHT type, level, result | FIGHT_BATCH count, wins |
+	STATS - | JOIN party i left | KILL sig, members signalled | INHERIT on |
+	JOIN_MANY count, joined | ROSTER cursor, copied |
+	WEIGHTS creatures, classes | LEADER new leader pid (0 for none) |
+	FORK child pid, 1 if it joined my party (only with sys_rpg_inherit on) |
+	EXIT - */
+#define RPG_TRACE_CREATE	0
+#define RPG_TRACE_FIGHT		1
+#define RPG_TRACE_FIGHT_BATCH	2
+#define RPG_TRACE_STATS		3
+#define RPG_TRACE_JOIN		4
+#define RPG_TRACE_KILL		5
+#define RPG_TRACE_INHERIT	6
+#define RPG_TRACE_JOIN_MANY	7
+#define RPG_TRACE_ROSTER	8
+#define RPG_TRACE_WEIGHTS	9
+#define RPG_TRACE_LEADER	10
+#define RPG_TRACE_FORK		11
+#define RPG_TRACE_EXIT		12
+
+struct rpg_trace_event{
+	unsigned long long tsc;
+	pid_t pid;		/* the task the event is about */
+	unsigned int party;	/* party id, 0 for none */
+	unsigned short event;
+	unsigned short cpu;
+	int arg[3];
+};
+
+/* read-only page a party publishes from its first mmap of /dev/rpg_stats
+	on, so rpg_get_stats() can read it without a syscall. seq is odd while the
+	kernel changes the page, readers retry until they see the same even
+	seq before and after. slots[] holds members by their stats_slot */
+struct rpg_stats_slot{
+	pid_t pid;	/* 0 for a free slot */
+	int cclass;
+	int level;
+};
+
+struct rpg_stats_page{
+	unsigned int seq;
+	int party_size;
+	int fighter_levels;
+	int mage_levels;
+	pid_t leader;		/* 0 while the party has no leader */
+	unsigned int epoch;	/* bumped whenever a member joins or leaves */
+	int nr_slots;
+	struct rpg_stats_slot slots[0];
+};
+
+#define RPG_STATS_SLOTS ((PAGE_SIZE - sizeof(struct rpg_stats_page)) / sizeof(struct rpg_stats_slot))
+
+/* max encounters in one sys_rpg_fight_batch, pids in one sys_rpg_join_many or
+	members in one sys_rpg_roster,
+	bounds the time the party lock is held */
+#define RPG_MAX_BATCH 1024
+
 
 
 
 
 
 /* define functions*/
+struct rpg_party;
 int has_character(struct task_struct *pros);
 int sys_rpg_create_character(int cclass);
 int sys_rpg_fight(int type , int level);
-int calc_strength(int type, struct task_struct * leader);
+int sys_rpg_fight_batch(struct rpg_encounter* encounters, int count, unsigned int* results);
+int calc_strength(int type, struct rpg_party* party);
+int sys_rpg_set_weights(int* weights, int creatures, int classes);
 int sys_rpg_get_stats(struct rpg_stats* stats);
-int get_cclass(struct task_struct* leader,pid_t pid);
-int get_player_level(struct task_struct* leader,pid_t pid);
 int sys_rpg_join(pid_t player);
-void moving_list(struct task_struct* source,struct task_struct* new);
-void update_leader(struct task_struct* dest);
-void move_my_node(pid_t my_id,struct task_struct* old_leader,struct task_struct* new_leader);
+int sys_rpg_party_kill(int sig);
+int sys_rpg_join_many(pid_t player, pid_t* pids, int count, int cclass, int* status);
+int sys_rpg_roster(pid_t player, struct rpg_member* roster, int count, int* cursor);
+int sys_rpg_inherit(int on);
 int rpg_fork(struct task_struct* son);
+void rpg_fork_inherit(struct task_struct* son);
 int rpg_exit(struct task_struct* proc);
 
 
 
-/* create player struct*/
-struct player {
-	pid_t player_pid;
-	int player_level;
-	int cclass;
-	struct list_head my_list;
+/* create party struct
+ *
+ * Locking: every party has its own lock, so fights in different parties
+ * never share a lock. party->lock protects members, size, leader and the
+ * levels of the players in the party.
+ * task->party and task->my_player are changed only by the task itself,
+ * while holding the lock of the party it leaves or enters and task_lock().
+ * The one exception is a task without a character, which may be given
+ * one by sys_rpg_join_many() or at fork, never once it is PF_EXITING.
+ * Other tasks read them under task_lock() and take a reference.
+ * Lock order: party->lock before task_lock(). When two parties are locked
+ * (sys_rpg_join) they are taken by ascending &party, like runqueues.
+ * class_levels, party->stats and stats_map are written under party->lock too, user
+ * space reads the page with the seq counter only.
+ */
+struct rpg_party {
+	spinlock_t lock;
+	atomic_t count;		/* one per member, plus temporary users */
+	unsigned int id;	/* names the party in the trace, never reused before wrapping */
+	int size;
+	int dying;		/* set by sys_rpg_party_kill(SIGKILL), no leader or joins */
+	struct task_struct* leader;	/* NULL while the party is dying */
+	struct list_head members;
+	int class_levels[RPG_MAX_CLASSES];	/* sum of the member levels per class */
+	struct rpg_stats_page* stats;	/* one page, NULL until the first mmap, freed with the party */
+	unsigned long stats_map[(RPG_STATS_SLOTS + BITS_PER_LONG - 1) / BITS_PER_LONG];	/* used slots */
 };
 
+/* SLAB cache for rpg_party structures (tsk->party), see proc_caches_init() */
+extern kmem_cache_t *rpg_party_cachep;
+
 
 
 #endif
@@ -318,6 +318,17 @@ extern struct user_struct root_user;
 
 typedef struct prio_array prio_array_t;
 
+/* create player struct, every task carries its own node so creating a
+   character needs no allocation (see rpg_funcs.h) */
+struct player {
+	pid_t player_pid;
+	int player_level;
+	int cclass;
+	struct task_struct* player_task;
+	struct list_head my_list;
+	int stats_slot;		/* my slot in party->stats, -1 if the page is full */
+};
+
 struct task_struct {
 	/*
 	 * offsets of these are hardcoded elsewhere - touch with care
@@ -376,6 +387,8 @@ struct task_struct {
 	 */
 	task_t *p_opptr, *p_pptr, *p_cptr, *p_ysptr, *p_osptr;
 	struct list_head thread_group;
+	/* our children that are zombies, and our place on p_pptr->zombies */
+	struct list_head zombies, zombie_node;
 
 	/* PID hash table linkage. */
 	task_t *pidhash_next;
@@ -453,9 +466,13 @@ struct task_struct {
 	void *journal_info;
 
 /*Adding new fields to task struct*/
-	int party_member;
-	struct list_head party_list;
-	struct task_struct* group_leader;
+	struct rpg_party* party;	/* the party i am in, NULL if no character */
+	struct player* my_player;	/* my own node in party->members */
+	struct player player_node;	/* my_player points here once i have a character */
+	int rpg_inherit;		/* my children join my party, see sys_rpg_inherit() */
+	cycles_t syscall_tsc;		/* entry of the syscall being accounted, 0 for none */
+	int syscall_nr;			/* and its number, see kernel/syscall_stats.c */
+	int syscall_dev;		/* char device major + 1 of an ioctl, 0 for none */
 /*****************************************/
 	
 
@@ -545,6 +562,8 @@ extern struct exec_domain	default_exec_domain;
     p_opptr:		&tsk,						\
     p_pptr:		&tsk,						\
     thread_group:	LIST_HEAD_INIT(tsk.thread_group),		\
+    zombies:		LIST_HEAD_INIT(tsk.zombies),			\
+    zombie_node:	LIST_HEAD_INIT(tsk.zombie_node),		\
     wait_chldexit:	__WAIT_QUEUE_HEAD_INITIALIZER(tsk.wait_chldexit),\
     real_timer:		{						\
 	function:		it_real_fn				\
@@ -565,9 +584,9 @@ extern struct exec_domain	default_exec_domain;
     blocked:		{{0}},						\
     alloc_lock:		SPIN_LOCK_UNLOCKED,				\
     journal_info:	NULL,						\
-    party_member:	0,						\
-    party_list:		LIST_HEAD_INIT(tsk.party_list),			\
-    group_leader:	&tsk,						\
+    party:		NULL,						\
+    my_player:		NULL,						\
+    rpg_inherit:	0,						\
 }
 
 
@@ -922,6 +941,7 @@ do {									\
 		(p)->p_ysptr->p_osptr = (p)->p_osptr; \
 	else \
 		(p)->p_pptr->p_cptr = (p)->p_osptr; \
+	list_del_init(&(p)->zombie_node); \
 	} while (0)
 
 #define SET_LINKS(p) do { \
@@ -933,6 +953,8 @@ do {									\
 	if (((p)->p_osptr = (p)->p_pptr->p_cptr) != NULL) \
 		(p)->p_osptr->p_ysptr = p; \
 	(p)->p_pptr->p_cptr = p; \
+	if ((p)->state == TASK_ZOMBIE) \
+		list_add_tail(&(p)->zombie_node, &(p)->p_pptr->zombies); \
 	} while (0)
 
 #define for_each_task(p) \
@@ -455,6 +455,7 @@ static void exit_notify(void)
 
 	write_lock_irq(&tasklist_lock);
 	current->state = TASK_ZOMBIE;
+	list_add_tail(&current->zombie_node, &current->p_pptr->zombies);
 	do_notify_parent(current, current->exit_signal);
 	while (current->p_cptr != NULL) {
 		p = current->p_cptr;
@@ -467,8 +468,11 @@ static void exit_notify(void)
 		if (p->p_osptr)
 			p->p_osptr->p_ysptr = p;
 		p->p_pptr->p_cptr = p;
-		if (p->state == TASK_ZOMBIE)
+		if (p->state == TASK_ZOMBIE) {
+			list_del(&p->zombie_node);
+			list_add_tail(&p->zombie_node, &p->p_pptr->zombies);
 			do_notify_parent(p, p->exit_signal);
+		}
 		/*
 		 * process group orphan check
 		 * Case ii: Our child is in a different pgrp
@@ -568,11 +572,92 @@ asmlinkage long sys_exit(int error_code)
 	do_exit((error_code&0xff)<<8);
 }
 
+/* is p a child of ours, or of our thread group unless __WNOTHREAD is set */
+static inline int wait_our_child(struct task_struct *p, int options)
+{
+	if (p->p_pptr == current)
+		return 1;
+	return !(options & __WNOTHREAD) && (p->p_pptr->tgid == current->tgid);
+}
+
+/* does child p match the pid and the clone selection of wait4 */
+static inline int wait_match(struct task_struct *p, pid_t pid, int options)
+{
+	if (pid>0) {
+		if (p->pid != pid)
+			return 0;
+	} else if (!pid) {
+		if (p->pgrp != current->pgrp)
+			return 0;
+	} else if (pid != -1) {
+		if (p->pgrp != -pid)
+			return 0;
+	}
+	/* Wait for all children (clone and not) if __WALL is set;
+	 * otherwise, wait for clone children *only* if __WCLONE is
+	 * set; otherwise, wait for non-clone children *only*.  (Note:
+	 * A "clone" child here is one that reports to its parent
+	 * using a signal other than SIGCHLD.) */
+	if (((p->exit_signal != SIGCHLD) ^ ((options & __WCLONE) != 0))
+	    && !(options & __WALL))
+		return 0;
+	return 1;
+}
+
+/*
+ * Report a matching child that stopped or died. Called with tasklist_lock
+ * read locked. Returns 0 with the lock still held if p has nothing to
+ * report, else drops the lock and returns p's pid or an error.
+ */
+static int wait_task(struct task_struct *p, int options, unsigned int * stat_addr, struct rusage * ru)
+{
+	int retval;
+
+	switch (p->state) {
+	case TASK_STOPPED:
+		if (!p->exit_code)
+			return 0;
+		if (!(options & WUNTRACED) && !(p->ptrace & PT_PTRACED))
+			return 0;
+		read_unlock(&tasklist_lock);
+		retval = ru ? getrusage(p, RUSAGE_BOTH, ru) : 0; 
+		if (!retval && stat_addr) 
+			retval = put_user((p->exit_code << 8) | 0x7f, stat_addr);
+		if (!retval) {
+			p->exit_code = 0;
+			retval = p->pid;
+		}
+		return retval;
+	case TASK_ZOMBIE:
+		current->times.tms_cutime += p->times.tms_utime + p->times.tms_cutime;
+		current->times.tms_cstime += p->times.tms_stime + p->times.tms_cstime;
+		read_unlock(&tasklist_lock);
+		retval = ru ? getrusage(p, RUSAGE_BOTH, ru) : 0;
+		if (!retval && stat_addr)
+			retval = put_user(p->exit_code, stat_addr);
+		if (retval)
+			return retval;
+		retval = p->pid;
+		if (p->p_opptr != p->p_pptr) {
+			write_lock_irq(&tasklist_lock);
+			REMOVE_LINKS(p);
+			p->p_pptr = p->p_opptr;
+			SET_LINKS(p);
+			do_notify_parent(p, SIGCHLD);
+			write_unlock_irq(&tasklist_lock);
+		} else
+			release_task(p);
+		return retval;
+	}
+	return 0;
+}
+
 asmlinkage long sys_wait4(pid_t pid,unsigned int * stat_addr, int options, struct rusage * ru)
 {
 	int flag, retval;
 	DECLARE_WAITQUEUE(wait, current);
-	struct task_struct *tsk;
+	struct task_struct *tsk, *p;
+	struct list_head *pos;
 
 	if (options & ~(WNOHANG|WUNTRACED|__WNOTHREAD|__WCLONE|__WALL))
 		return -EINVAL;
@@ -582,72 +667,48 @@ repeat:
 	flag = 0;
 	current->state = TASK_INTERRUPTIBLE;
 	read_lock(&tasklist_lock);
+	/* A single child is one pid hash lookup. */
+	if (pid>0) {
+		p = find_task_by_pid(pid);
+		if (p && wait_our_child(p, options) && wait_match(p, pid, options)) {
+			flag = 1;
+			retval = wait_task(p, options, stat_addr, ru);
+			if (retval)
+				goto end_wait4;
+		}
+		goto unlock;
+	}
+	/* A zombie is on its parent's zombies list, no need to walk the live children. */
+	tsk = current;
+	do {
+		list_for_each(pos, &tsk->zombies) {
+			p = list_entry(pos, struct task_struct, zombie_node);
+			if (!wait_match(p, pid, options))
+				continue;
+			retval = wait_task(p, options, stat_addr, ru);
+			if (retval)
+				goto end_wait4;
+		}
+		if (options & __WNOTHREAD)
+			break;
+		tsk = next_thread(tsk);
+	} while (tsk != current);
+	/* No zombie, look for stopped children and whether we have any. */
 	tsk = current;
 	do {
-		struct task_struct *p;
 	 	for (p = tsk->p_cptr ; p ; p = p->p_osptr) {
-			if (pid>0) {
-				if (p->pid != pid)
-					continue;
-			} else if (!pid) {
-				if (p->pgrp != current->pgrp)
-					continue;
-			} else if (pid != -1) {
-				if (p->pgrp != -pid)
-					continue;
-			}
-			/* Wait for all children (clone and not) if __WALL is set;
-			 * otherwise, wait for clone children *only* if __WCLONE is
-			 * set; otherwise, wait for non-clone children *only*.  (Note:
-			 * A "clone" child here is one that reports to its parent
-			 * using a signal other than SIGCHLD.) */
-			if (((p->exit_signal != SIGCHLD) ^ ((options & __WCLONE) != 0))
-			    && !(options & __WALL))
+			if (!wait_match(p, pid, options))
 				continue;
 			flag = 1;
-			switch (p->state) {
-			case TASK_STOPPED:
-				if (!p->exit_code)
-					continue;
-				if (!(options & WUNTRACED) && !(p->ptrace & PT_PTRACED))
-					continue;
-				read_unlock(&tasklist_lock);
-				retval = ru ? getrusage(p, RUSAGE_BOTH, ru) : 0; 
-				if (!retval && stat_addr) 
-					retval = put_user((p->exit_code << 8) | 0x7f, stat_addr);
-				if (!retval) {
-					p->exit_code = 0;
-					retval = p->pid;
-				}
-				goto end_wait4;
-			case TASK_ZOMBIE:
-				current->times.tms_cutime += p->times.tms_utime + p->times.tms_cutime;
-				current->times.tms_cstime += p->times.tms_stime + p->times.tms_cstime;
-				read_unlock(&tasklist_lock);
-				retval = ru ? getrusage(p, RUSAGE_BOTH, ru) : 0;
-				if (!retval && stat_addr)
-					retval = put_user(p->exit_code, stat_addr);
-				if (retval)
-					goto end_wait4; 
-				retval = p->pid;
-				if (p->p_opptr != p->p_pptr) {
-					write_lock_irq(&tasklist_lock);
-					REMOVE_LINKS(p);
-					p->p_pptr = p->p_opptr;
-					SET_LINKS(p);
-					do_notify_parent(p, SIGCHLD);
-					write_unlock_irq(&tasklist_lock);
-				} else
-					release_task(p);
+			retval = wait_task(p, options, stat_addr, ru);
+			if (retval)
 				goto end_wait4;
-			default:
-				continue;
-			}
 		}
 		if (options & __WNOTHREAD)
 			break;
 		tsk = next_thread(tsk);
 	} while (tsk != current);
+unlock:
 	read_unlock(&tasklist_lock);
 	if (flag) {
 		retval = 0;
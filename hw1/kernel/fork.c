@@ -87,63 +87,63 @@ void __init fork_init(unsigned long mempages)
 	init_task.rlim[RLIMIT_NPROC].rlim_max = max_threads/2;
 }
 
-/* Protects next_safe and last_pid. */
+/* Protects pid_map and last_pid. */
 spinlock_t lastpid_lock = SPIN_LOCK_UNLOCKED;
 
-static int get_pid(unsigned long flags)
+/*
+ * Ids that may be in use as a pid, pgrp, tgid or session. A pgrp, tgid
+ * or session id is always some task's pid first, so setting the bit at
+ * allocation covers all four. Bits are not cleared when an id is freed,
+ * the map is only a superset; pid_map_rebuild() drops the stale ones once
+ * per pass over the pid space.
+ */
+static unsigned long pid_map[PID_MAX / BITS_PER_LONG];
+
+static void pid_map_rebuild(void)
 {
-	static int next_safe = PID_MAX;
 	struct task_struct *p;
-	int pid, beginpid;
+
+	memset(pid_map, 0, sizeof(pid_map));
+	read_lock(&tasklist_lock);
+	for_each_task(p) {
+		__set_bit(p->pid, pid_map);
+		__set_bit(p->pgrp, pid_map);
+		__set_bit(p->tgid, pid_map);
+		__set_bit(p->session, pid_map);
+	}
+	read_unlock(&tasklist_lock);
+}
+
+/*
+ * A find_next_zero_bit() from last_pid, the task list is only walked
+ * when the search wraps around, instead of every time last_pid reached
+ * the next id in use. That walk, pid_map_rebuild(), still takes
+ * tasklist_lock nested under lastpid_lock, the same order the old scan
+ * used; keeping the map exact without it would need clearing hooks
+ * where pgrp, session and tgid ids are dropped in exit.c and sys.c.
+ */
+static int get_pid(unsigned long flags)
+{
+	int pid;
 
 	if (flags & CLONE_PID)
 		return current->pid;
 
 	spin_lock(&lastpid_lock);
-	beginpid = last_pid;
-	if((++last_pid) & 0xffff8000) {
-		last_pid = 300;		/* Skip daemons etc. */
-		goto inside;
-	}
-	if(last_pid >= next_safe) {
-inside:
-		next_safe = PID_MAX;
-		read_lock(&tasklist_lock);
-	repeat:
-		for_each_task(p) {
-			if(p->pid == last_pid	||
-			   p->pgrp == last_pid	||
-			   p->tgid == last_pid	||
-			   p->session == last_pid) {
-				if(++last_pid >= next_safe) {
-					if(last_pid & 0xffff8000)
-						last_pid = 300;
-					next_safe = PID_MAX;
-				}
-				if(unlikely(last_pid == beginpid))
-					goto nomorepids;
-				goto repeat;
-			}
-			if(p->pid > last_pid && next_safe > p->pid)
-				next_safe = p->pid;
-			if(p->pgrp > last_pid && next_safe > p->pgrp)
-				next_safe = p->pgrp;
-			if(p->tgid > last_pid && next_safe > p->tgid)
-				next_safe = p->tgid;
-			if(p->session > last_pid && next_safe > p->session)
-				next_safe = p->session;
+	pid = find_next_zero_bit(pid_map, PID_MAX, last_pid + 1);
+	if (pid >= PID_MAX) {
+		pid_map_rebuild();
+		pid = find_next_zero_bit(pid_map, PID_MAX, 300);	/* Skip daemons etc. */
+		if (unlikely(pid >= PID_MAX)) {
+			spin_unlock(&lastpid_lock);
+			return 0;
 		}
-		read_unlock(&tasklist_lock);
 	}
-	pid = last_pid;
+	__set_bit(pid, pid_map);
+	last_pid = pid;
 	spin_unlock(&lastpid_lock);
 
 	return pid;
-
-nomorepids:
-	read_unlock(&tasklist_lock);
-	spin_unlock(&lastpid_lock);
-	return 0;
 }
 
 static inline int dup_mmap(struct mm_struct * mm)
@@ -659,6 +659,8 @@ int do_fork(unsigned long clone_flags, unsigned long stack_start,
 	INIT_LIST_HEAD(&p->run_list);
 
 	p->p_cptr = NULL;
+	INIT_LIST_HEAD(&p->zombies);
+	INIT_LIST_HEAD(&p->zombie_node);
 	init_waitqueue_head(&p->wait_chldexit);
 	p->vfork_done = NULL;
 	if (clone_flags & CLONE_VFORK) {
@@ -763,6 +765,10 @@ int do_fork(unsigned long clone_flags, unsigned long stack_start,
 	p->tgid = retval;
 	INIT_LIST_HEAD(&p->thread_group);
 
+/****** adding fork func **********/
+	rpg_fork_inherit(son);
+/*********************************/
+
 	/* Need tasklist lock for parent etc handling! */
 	write_lock_irq(&tasklist_lock);
 
@@ -838,6 +844,9 @@ kmem_cache_t *vm_area_cachep;
 /* SLAB cache for mm_struct structures (tsk->mm) */
 kmem_cache_t *mm_cachep;
 
+/* SLAB cache for rpg_party structures (tsk->party) */
+kmem_cache_t *rpg_party_cachep;
+
 void __init proc_caches_init(void)
 {
 	sigact_cachep = kmem_cache_create("signal_act",
@@ -869,4 +878,10 @@ void __init proc_caches_init(void)
 			SLAB_HWCACHE_ALIGN, NULL, NULL);
 	if(!mm_cachep)
 		panic("vma_init: Cannot alloc mm_struct SLAB cache");
+
+	rpg_party_cachep = kmem_cache_create("rpg_party",
+			sizeof(struct rpg_party), 0,
+			SLAB_HWCACHE_ALIGN, NULL, NULL);
+	if(!rpg_party_cachep)
+		panic("Cannot create rpg_party SLAB cache");
 }
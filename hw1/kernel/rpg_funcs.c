@@ -1,6 +1,12 @@
 
 #include <linux/rpg_funcs.h>
 #include <asm/current.h>
+#include <linux/string.h>
+#include <linux/mm.h>
+#include <linux/init.h>
+#include <linux/miscdevice.h>
+#include <linux/compiler.h>
+#include <asm/timex.h>
 
 
 
@@ -12,25 +18,295 @@
 #define CREATURE_DEMON 1
 #define MAGE 1
 #define FIGHTER 0
-#define NOT_A_MEMBER 0
-#define MEMBER 1
+
+
+
+/* weight of every class against every creature. the strength of a party
+	against a creature is the dot product of its row with the class level
+	sums of the party, see calc_strength(). sys_rpg_set_weights() loads a
+	new table, writers take rpg_weights_lock and keep rpg_weights_seq odd
+	while they change it so fights read it without a lock */
+static int rpg_weights[RPG_MAX_CREATURES][RPG_MAX_CLASSES] = {
+	[CREATURE_ORC] = { [FIGHTER] = 2, [MAGE] = 1 },
+	[CREATURE_DEMON] = { [FIGHTER] = 1, [MAGE] = 2 },
+};
+static int rpg_nr_creatures = 2;
+static int rpg_nr_classes = 2;
+static int rpg_weights_builtin = 1;	/* the table above, calc_strength() has it inline */
+static unsigned int rpg_weights_seq = 0;
+static spinlock_t rpg_weights_lock = SPIN_LOCK_UNLOCKED;
+
+
+
+/* RPG trace: every event goes to the ring of the CPU it happens on. the
+	RPG code always runs in process context and the kernel does not preempt
+	it, so only that CPU writes its ring and the rings need no lock; a reader
+	may see an entry that is being overwritten. off by default, then an event
+	costs one test. read and turned on or off through /dev/rpg_trace */
+#define RPG_TRACE_SIZE 256	/* entries per CPU, a power of 2 */
+
+struct rpg_trace_ring{
+	unsigned int head;	/* entries written so far */
+	struct rpg_trace_event entry[RPG_TRACE_SIZE];
+} ____cacheline_aligned;
+
+static struct rpg_trace_ring rpg_traces[NR_CPUS];
+static int rpg_trace_on = 0;
+static unsigned int rpg_party_ids = 0;	/* the last party id given */
+static spinlock_t rpg_party_ids_lock = SPIN_LOCK_UNLOCKED;
+
+static void __rpg_trace(int event, struct task_struct* proc, struct rpg_party* party, int a0, int a1, int a2){
+	int cpu = smp_processor_id();
+	struct rpg_trace_ring *ring = rpg_traces + cpu;
+	struct rpg_trace_event *e = ring->entry + (ring->head++ & (RPG_TRACE_SIZE - 1));
+	e->tsc = get_cycles();
+	e->pid = proc->pid;
+	e->party = party ? party->id : 0;
+	e->event = event;
+	e->cpu = cpu;
+	e->arg[0] = a0;
+	e->arg[1] = a1;
+	e->arg[2] = a2;
+}
+
+#define rpg_trace(event, proc, party, a0, a1, a2) do{ \
+	if(unlikely(rpg_trace_on)) \
+		__rpg_trace(event, proc, party, a0, a1, a2); \
+}while(0)
 
 
 
 /* check if a proccess has created a character
 	returns 1 if it has , 0 otherwise */
 int has_character(struct task_struct *pros){
-	if(list_empty(&(pros->party_list))){
-		if(pros->party_member){
-			return 1;
+	if(pros->my_player){
+		return 1;
+	}else{
+		return 0;
+	}
+}
+
+/******************************************************************************************************/
+/* party helpers, see the locking rules in rpg_funcs.h */
+
+static struct rpg_party* party_alloc(void){
+	struct rpg_party* party = kmem_cache_alloc(rpg_party_cachep, GFP_KERNEL);
+	if(party == NULL){
+		return NULL;
+	}
+	spin_lock_init(&party->lock);
+	atomic_set(&party->count, 0);
+	spin_lock(&rpg_party_ids_lock);
+	party->id = ++rpg_party_ids;
+	spin_unlock(&rpg_party_ids_lock);
+	party->size = 0;
+	party->dying = 0;
+	party->leader = NULL;
+	INIT_LIST_HEAD(&party->members);
+	memset(party->class_levels, 0, sizeof(party->class_levels));
+	//the stats page comes with the first rpg_stats_mmap(), see stats_fill()
+	party->stats = NULL;
+	memset(party->stats_map, 0, sizeof(party->stats_map));
+	return party;
+}
+
+/* free a party nobody uses anymore. the stats page lives on while someone
+	still has it mapped, the mappings hold their own page reference */
+static void party_free(struct rpg_party* party){
+	if(party->stats){
+		free_page((unsigned long)party->stats);
+	}
+	kmem_cache_free(rpg_party_cachep, party);
+}
+
+/* drop a reference, the last one frees the party */
+static void party_put(struct rpg_party* party){
+	if(atomic_dec_and_test(&party->count)){
+		party_free(party);
+	}
+}
+
+/* party->stats is only written under party->lock so there is one writer at
+	a time, seq is odd while it does. nothing to do before the party has a
+	stats page */
+static inline void stats_begin(struct rpg_party* party){
+	if(party->stats == NULL){
+		return;
+	}
+	party->stats->seq++;
+	wmb();
+}
+
+/* the level sums on the page follow party->class_levels */
+static inline void stats_end(struct rpg_party* party){
+	if(party->stats == NULL){
+		return;
+	}
+	party->stats->fighter_levels = party->class_levels[FIGHTER];
+	party->stats->mage_levels = party->class_levels[MAGE];
+	wmb();
+	party->stats->seq++;
+}
+
+/* give party its stats page, party->lock held. page is zeroed and not
+	mapped yet, so no reader sees it half filled */
+static void stats_fill(struct rpg_party* party, struct rpg_stats_page* page){
+	struct player *entry;
+	struct list_head* position;
+	int slot = 0;
+	page->nr_slots = RPG_STATS_SLOTS;
+	list_for_each(position, &party->members){
+		entry = list_entry (position, struct player, my_list);
+		if(slot < RPG_STATS_SLOTS){
+			__set_bit(slot, party->stats_map);
+			page->slots[slot].pid = entry->player_pid;
+			page->slots[slot].cclass = entry->cclass;
+			page->slots[slot].level = entry->player_level;
+			entry->stats_slot = slot++;
 		}else{
-			return 0;
+			entry->stats_slot = -1;
 		}
+	}
+	page->party_size = party->size;
+	page->leader = party->leader ? party->leader->pid : 0;
+	page->fighter_levels = party->class_levels[FIGHTER];
+	page->mage_levels = party->class_levels[MAGE];
+	party->stats = page;
+}
+
+/* get the party of another task with a reference held, NULL if it has no character */
+static struct rpg_party* get_task_party(struct task_struct* proc){
+	struct rpg_party* party;
+	task_lock(proc);
+	party = proc->party;
+	if(party){
+		atomic_inc(&party->count);
+	}
+	task_unlock(proc);
+	return party;
+}
+
+/* lock two parties by ascending address, they may be the same party */
+static void lock_two_parties(struct rpg_party* a, struct rpg_party* b){
+	if(a == b){
+		spin_lock(&a->lock);
+	}else if(a < b){
+		spin_lock(&a->lock);
+		spin_lock(&b->lock);
 	}else{
-		return 1;
+		spin_lock(&b->lock);
+		spin_lock(&a->lock);
+	}
+}
+
+static void unlock_two_parties(struct rpg_party* a, struct rpg_party* b){
+	spin_unlock(&a->lock);
+	if(a != b){
+		spin_unlock(&b->lock);
+	}
+}
+
+/* add proc with its node to party, party->lock and task_lock(proc) held.
+	takes a member reference */
+static void __party_add(struct rpg_party* party, struct task_struct* proc, struct player* node){
+	struct rpg_stats_page *page = party->stats;
+	atomic_inc(&party->count);
+	list_add_tail(&node->my_list, &party->members);
+	party->size++;
+	if(party->leader == NULL){
+		party->leader = proc;
+		rpg_trace(RPG_TRACE_LEADER, proc, party, proc->pid, 0, 0);
+	}
+	//publish the new member, a party bigger than the page or without a
+	//page has members without a slot and they fall back to the syscall
+	int slot = find_first_zero_bit(party->stats_map, RPG_STATS_SLOTS);
+	stats_begin(party);
+	if(page && slot < RPG_STATS_SLOTS){
+		__set_bit(slot, party->stats_map);
+		page->slots[slot].pid = node->player_pid;
+		page->slots[slot].cclass = node->cclass;
+		page->slots[slot].level = node->player_level;
+	}else{
+		slot = -1;
+	}
+	node->stats_slot = slot;
+	if(page){
+		page->party_size = party->size;
+		page->leader = party->leader->pid;
+		page->epoch++;
+	}
+	party->class_levels[node->cclass] += node->player_level;
+	stats_end(party);
+	proc->party = party;
+	//has_character() is read without the lock, the party has to be there first
+	wmb();
+	proc->my_player = node;
+}
+
+/* add proc with its node to party, party->lock held */
+static void party_add(struct rpg_party* party, struct task_struct* proc, struct player* node){
+	task_lock(proc);
+	__party_add(party, proc, node);
+	task_unlock(proc);
+}
+
+/* give proc a new level 1 character of cclass in party, party->lock held.
+	fails if proc already has a character, or is exiting and so past
+	rpg_exit() */
+static int party_enroll(struct rpg_party* party, struct task_struct* proc, int cclass){
+	struct player *character = &proc->player_node;
+	int res = SUCCESS;
+	task_lock(proc);
+	if(proc->my_player){
+		res = -EEXIST;
+	}else if(proc->flags & PF_EXITING){
+		res = -ESRCH;
+	}else{
+		character->player_level = 1;
+		character->player_pid = proc->pid;
+		character->player_task = proc;
+		character->cclass = cclass;
+		__party_add(party, proc, character);
+	}
+	task_unlock(proc);
+	return res;
+}
+
+/* remove proc node from party, party->lock held. the caller drops the member
+	reference with party_put() after unlocking */
+static void party_remove(struct rpg_party* party, struct task_struct* proc){
+	struct player *node = proc->my_player;
+	struct rpg_stats_page *page = party->stats;
+	list_del(&node->my_list);
+	party->size--;
+	if(party->dying){
+		//the party is being killed, no point electing a leader for every exit
+		party->leader = NULL;
+	}else if(party->leader == proc){
+		//the first node left in the list is the new leader
+		if(list_empty(&party->members)){
+			party->leader = NULL;
+		}else{
+			party->leader = list_entry(party->members.next, struct player, my_list)->player_task;
+		}
+		rpg_trace(RPG_TRACE_LEADER, proc, party, party->leader ? party->leader->pid : 0, 0, 0);
+	}
+	stats_begin(party);
+	if(node->stats_slot >= 0){
+		page->slots[node->stats_slot].pid = 0;
+		__clear_bit(node->stats_slot, party->stats_map);
 	}
+	if(page){
+		page->party_size = party->size;
+		page->leader = party->leader ? party->leader->pid : 0;
+		page->epoch++;
+	}
+	party->class_levels[node->cclass] -= node->player_level;
+	stats_end(party);
 }
 
+/******************************************************************************************************/
+
 /* user POV , need to implement wrapper function */
 
 int sys_rpg_create_character(int cclass){
@@ -42,47 +318,82 @@ int sys_rpg_create_character(int cclass){
 		//errno = EEXIST;
 		return -EEXIST;
 	}
-	else{
-		//player does not have a character, create one
-		struct player *character = (struct player *)kmalloc(sizeof(struct player), GFP_KERNEL);
-		if(character == NULL){
-			//allocation failed
-			//errno = -ENOMEM;
-			return -ENOMEM;
-		}
-		character->player_level = 1;
-		pid_t my_id = current_task->pid;
-		character->player_pid = my_id;
-		if(cclass == MAGE){
-			//mage charecter
-			character->cclass = MAGE;	
-		}else if(cclass == FIGHTER){
-			//fighter charecter
-			character->cclass = FIGHTER;
-		}else{
-			kfree(character);
-			//errno = EINVAL;
-			return -EINVAL;
-		}
-		//player is not a part of a party, he is his own group leader
-		current_task -> group_leader = current_task;
-		//add player to his party list
-		list_add_tail(&character->my_list, &(current_task->party_list));
-		//printk(KERN_INFO " process has created character with pid %d\n",character->player_pid);
-		return SUCCESS; 
+	if(cclass < 0 || cclass >= rpg_nr_classes){
+		//errno = EINVAL;
+		return -EINVAL;
+	}
+	//player is not a part of a party, he is the leader of his own party
+	struct rpg_party *party = party_alloc();
+	if(party == NULL){
+		//allocation failed
+		//errno = -ENOMEM;
+		return -ENOMEM;
 	}
+	//the party is still private, but party_enroll() expects the lock.
+	//it checks again, sys_rpg_join_many() may have given us a character
+	spin_lock(&party->lock);
+	int res = party_enroll(party, current_task, cclass);
+	spin_unlock(&party->lock);
+	if(res){
+		party_free(party);
+		return res;
+	}
+	//printk(KERN_INFO " process has created character with pid %d\n",current_task->pid);
+	rpg_trace(RPG_TRACE_CREATE, current_task, party, cclass, 0, 0);
+	return SUCCESS; 
 	
 }
 
 /******************************************************************************************************/
 
+/* fight one creature and update the levels, party->lock held */
+static int party_fight(struct rpg_party* party, int type, int level){
+	struct player *entry;
+	struct list_head* position;
+	struct rpg_stats_page *page = party->stats;
+	int strength = calc_strength(type,party);
+	int res;
+	stats_begin(party);
+	if(strength >= level){
+		//party wins
+		list_for_each(position, &party->members){
+			entry = list_entry (position, struct player, my_list);
+			(entry->player_level)++;
+			party->class_levels[entry->cclass]++;
+			//printk(KERN_INFO "player with pid %d win and now his level is %d\n",entry->player_pid,entry->player_level);
+			if(entry->stats_slot >= 0){
+				page->slots[entry->stats_slot].level = entry->player_level;
+			}
+		}
+		res = WIN;
+	}
+	else{
+		//party lost
+		list_for_each(position, &party->members){
+			entry = list_entry (position, struct player, my_list);
+			//printk(KERN_INFO "player with pid %d loose and now his level is %d\n",entry->player_pid,entry->player_level);
+			//levels don't go below 0
+			if(entry->player_level > 0){
+				(entry->player_level)--;
+				party->class_levels[entry->cclass]--;
+			}
+			if(entry->stats_slot >= 0){
+				page->slots[entry->stats_slot].level = entry->player_level;
+			}
+		}
+		res = LOSE;
+	}
+	stats_end(party);
+	return res;
+}
+
 int sys_rpg_fight(int type , int level){
 
 	
 	struct task_struct *current_task = current;
 	//printk(KERN_INFO "process with pid %d entered the fight func\n",current_task->pid);
 	// check if arguments are valid
-	 if (level < 0 || (type != CREATURE_ORC && type != CREATURE_DEMON)) {
+	 if (level < 0 || type < 0 || type >= rpg_nr_creatures) {
         return -EINVAL;
     }
 	//check if process has a character
@@ -92,73 +403,151 @@ int sys_rpg_fight(int type , int level){
 		return -EINVAL;	
 	}
 
-	//getting the party info
-	struct task_struct* leader = current -> group_leader;
-	int strength = calc_strength(type,leader);
-	if(strength >= level){
-		//party wins
-		struct player *entry;
-		struct list_head* tmp;
-		struct list_head* position;
-		list_for_each_safe (position, tmp, &(leader->party_list)){
-			entry = list_entry (position, struct player, my_list);
-			(entry->player_level)++;
-			//printk(KERN_INFO "player with pid %d win and now his level is %d\n",entry->player_pid,entry->player_level);
+	//getting the party info, only we can change our party so it can't go away
+	struct rpg_party* party = current_task->party;
+	int res;
+	spin_lock(&party->lock);
+	res = party_fight(party, type, level);
+	spin_unlock(&party->lock);
+	rpg_trace(RPG_TRACE_FIGHT, current_task, party, type, level, res);
+	return res;
+			
+}
+
+/* fight many creatures in one call. encounters are fought in order under one
+	party lock, bit i of results is set if encounter i was won.
+	returns the number of wins */
+int sys_rpg_fight_batch(struct rpg_encounter* encounters, int count, unsigned int* results){
+	struct task_struct *current_task = current;
+	if(encounters == NULL || results == NULL || count <= 0 || count > RPG_MAX_BATCH){
+		return -EINVAL;
+	}
+	if(!has_character(current_task)){
+		return -EINVAL;
+	}
+	int words = (count + 31) / 32;
+	struct rpg_encounter *fights = (struct rpg_encounter *)kmalloc(count * sizeof(struct rpg_encounter), GFP_KERNEL);
+	if(fights == NULL){
+		return -ENOMEM;
+	}
+	unsigned int *bitmap = (unsigned int *)kmalloc(words * sizeof(unsigned int), GFP_KERNEL);
+	if(bitmap == NULL){
+		kfree(fights);
+		return -ENOMEM;
+	}
+	int res;
+	if(copy_from_user(fights, encounters, count * sizeof(struct rpg_encounter))){
+		res = -EFAULT;
+		goto out;
+	}
+	//check all the encounters before fighting any of them
+	int i;
+	for(i = 0; i < count; i++){
+		if(fights[i].level < 0 || fights[i].type < 0 || fights[i].type >= rpg_nr_creatures){
+			res = -EINVAL;
+			goto out;
 		}
-		
-		return WIN;		
 	}
-	else{
-		//party lost
-		struct player *entry;
-		struct list_head* tmp;
-		struct list_head* position;
-		list_for_each_safe (position, tmp, &(leader->party_list)){
-			entry = list_entry (position, struct player, my_list);
-			(entry->player_level)--;
-			//printk(KERN_INFO "player with pid %d loose and now his level is %d\n",entry->player_pid,entry->player_level);
-			if(entry->player_level < 0){
-				entry->player_level = 0;
-					
-			}
+	memset(bitmap, 0, words * sizeof(unsigned int));
+	struct rpg_party* party = current_task->party;
+	int wins = 0;
+	spin_lock(&party->lock);
+	for(i = 0; i < count; i++){
+		if(party_fight(party, fights[i].type, fights[i].level) == WIN){
+			bitmap[i / 32] |= 1U << (i % 32);
+			wins++;
 		}
-		return LOSE;
 	}
-			
+	spin_unlock(&party->lock);
+	//sending the results back to user, not under the lock since it may sleep
+	if(copy_to_user(results, bitmap, words * sizeof(unsigned int))){
+		res = -EFAULT;
+		goto out;
+	}
+	res = wins;
+	rpg_trace(RPG_TRACE_FIGHT_BATCH, current_task, party, count, wins, 0);
+out:
+	kfree(bitmap);
+	kfree(fights);
+	return res;
 }
 	
 
 
 
-int calc_strength(int type, struct task_struct * leader){
-	int strength = 0;
-	if(type == CREATURE_ORC){
-		struct player *entry;
-		struct list_head* tmp;
-		struct list_head* position;
-		list_for_each_safe(position,tmp,&(leader->party_list)){
-			entry = list_entry (position, struct player, my_list);
-			if(entry->cclass == FIGHTER ){
-				strength += 2*(entry->player_level);
-			}else if(entry->cclass == MAGE){
-				strength += (entry->player_level);
+/* party->lock held. O(classes) from the class level sums, whatever the
+	size of the party */
+int calc_strength(int type, struct rpg_party* party){
+	int *levels = party->class_levels;
+	unsigned int seq;
+	int strength, c;
+	do{
+		seq = rpg_weights_seq;
+		rmb();
+		if(rpg_weights_builtin){
+			//the built-in table, the weights are constants here
+			if(type == CREATURE_ORC){
+				strength = 2*levels[FIGHTER] + levels[MAGE];
+			}else if(type == CREATURE_DEMON){
+				strength = levels[FIGHTER] + 2*levels[MAGE];
+			}else{
+				strength = 0;
+			}
+		}else{
+			strength = 0;
+			for(c = 0; c < rpg_nr_classes; c++){
+				strength += rpg_weights[type][c] * levels[c];
 			}
 		}
+		rmb();
+	}while((seq & 1) || seq != rpg_weights_seq);
+	return strength;
+}
+
+/* load a new weight table, weights[creature * classes + class]. creature and
+	class numbers stay what they were, so there are at least as many classes
+	as before (characters may have any of them) and at least the two built-in
+	creatures. needs CAP_SYS_ADMIN */
+int sys_rpg_set_weights(int* weights, int creatures, int classes){
+	int table[RPG_MAX_CREATURES][RPG_MAX_CLASSES];
+	int i, c, builtin;
+	if(!capable(CAP_SYS_ADMIN)){
+		return -EPERM;
 	}
-	if(type == CREATURE_DEMON){
-		struct player *entry;
-		struct list_head* tmp;
-		struct list_head* position;
-		list_for_each_safe(position,tmp,&(leader->party_list)){
-			entry = list_entry (position, struct player, my_list);
-			if(entry->cclass == FIGHTER ){
-				strength += (entry->player_level);
-			}else if(entry->cclass == MAGE){
-				strength += 2*(entry->player_level);
+	if(weights == NULL || creatures < 2 || creatures > RPG_MAX_CREATURES || classes < 2 || classes > RPG_MAX_CLASSES){
+		return -EINVAL;
+	}
+	memset(table, 0, sizeof(table));
+	for(i = 0; i < creatures; i++){
+		if(copy_from_user(table[i], weights + i * classes, classes * sizeof(int))){
+			return -EFAULT;
+		}
+		for(c = 0; c < classes; c++){
+			if(table[i][c] < 0){
+				return -EINVAL;
 			}
 		}
 	}
-	return strength;
+	//the inline path only knows two creatures, a third one needs the table
+	builtin = (creatures == 2 && classes == 2
+		&& table[CREATURE_ORC][FIGHTER] == 2 && table[CREATURE_ORC][MAGE] == 1
+		&& table[CREATURE_DEMON][FIGHTER] == 1 && table[CREATURE_DEMON][MAGE] == 2);
+	spin_lock(&rpg_weights_lock);
+	if(classes < rpg_nr_classes){
+		spin_unlock(&rpg_weights_lock);
+		return -EINVAL;
+	}
+	rpg_weights_seq++;
+	wmb();
+	memcpy(rpg_weights, table, sizeof(table));
+	rpg_nr_creatures = creatures;
+	rpg_nr_classes = classes;
+	rpg_weights_builtin = builtin;
+	wmb();
+	rpg_weights_seq++;
+	spin_unlock(&rpg_weights_lock);
+	rpg_trace(RPG_TRACE_WEIGHTS, current, NULL, creatures, classes, 0);
+	return SUCCESS;
 }
 /******************************************************************************************************/
 
@@ -176,279 +565,482 @@ int sys_rpg_get_stats(struct rpg_stats* stats){
 		//errno = EINVAL;
 		return -EINVAL;	
 	}
-	struct rpg_stats* my_stats = (struct rpg_stats*)kmalloc(sizeof(struct rpg_stats), GFP_KERNEL);
-	if(my_stats == NULL){
-
-		//printk(KERN_INFO "failed to Allocate\n");
-		//allocation failed
-		//errno = -ENOMEM;
-		return -ENOMEM;
-	}
-	//getting the party info
-	pid_t my_id = current_task->pid;
-	struct task_struct* leader = current -> group_leader;
-	int cclass = get_cclass(leader,my_id); 
-	int player_level = get_player_level(leader,my_id);
-	int size = 0;
-	int fighter_levels = 0;
-	int mage_levels = 0;
-	struct player *entry;
-	struct list_head* tmp;
-	struct list_head* position;
-	list_for_each_safe(position,tmp,&(leader->party_list)){
-		entry = list_entry (position, struct player, my_list);
-		size++;
-		if(entry->cclass == FIGHTER){
-			fighter_levels += entry->player_level;
-		}
-		else if(entry->cclass == MAGE){
-			mage_levels += entry->player_level;
-		}
-	}
+	struct rpg_stats my_stats;
+	//getting the party info, the stats page keeps the level sums up to date
+	struct rpg_party* party = current_task->party;
+	spin_lock(&party->lock);
 	//filling the party info
-	my_stats->cclass = cclass;
-	my_stats->level = player_level;
-	my_stats->party_size = size;
-	my_stats->fighter_levels = fighter_levels;
-	my_stats->mage_levels = mage_levels;
-
-	//sending info back to user 
-	if(copy_to_user(stats,my_stats,sizeof(struct rpg_stats))){
+	my_stats.cclass = current_task->my_player->cclass;
+	my_stats.level = current_task->my_player->player_level;
+	my_stats.party_size = party->size;
+	my_stats.fighter_levels = party->class_levels[FIGHTER];
+	my_stats.mage_levels = party->class_levels[MAGE];
+	spin_unlock(&party->lock);
+	rpg_trace(RPG_TRACE_STATS, current_task, party, 0, 0, 0);
+
+	//sending info back to user, not under the lock since it may sleep
+	if(copy_to_user(stats,&my_stats,sizeof(struct rpg_stats))){
 		//errno = EFAULT;  // Bad address
 		//printk(KERN_INFO "failed to send\n");
-		kfree(my_stats);
 		return -EFAULT;
 	}
-	kfree(my_stats);
 	return SUCCESS;
 }
 
-int get_cclass(struct task_struct* leader,pid_t pid){
-	struct player *entry;
-	struct list_head* tmp;
-	struct list_head* position;
-    list_for_each_safe(position,tmp, &(leader->party_list)) {
-		entry = list_entry (position, struct player, my_list);
-        if (entry->player_pid == pid)
-            return (entry->cclass);
-    }
-	return ERROR;
-}
-
-int get_player_level(struct task_struct* leader,pid_t pid){
-	struct player *entry;
-	struct list_head* tmp;
-	struct list_head* position;
-    list_for_each_safe(position,tmp, &(leader->party_list)) {
-		entry = list_entry (position, struct player, my_list);
-        if (entry->player_pid == pid)
-            return (entry->player_level);
-    }
-	return ERROR;
-}
-
 /******************************************************************************************************/
 
 int sys_rpg_join(pid_t player){
 	struct task_struct *current_task = current;
 	//printk(KERN_INFO "in join pid input is %d\n",player);
 	struct task_struct *player_task;
+	struct rpg_party *target;
+	read_lock(&tasklist_lock);
 	player_task = find_task_by_pid(player); 
-	//printk(KERN_INFO "process with pid %d is trying to join process with pid %d\n",current_task->pid,player_task->pid);
 	if(!player_task){
+		read_unlock(&tasklist_lock);
 		//printk(KERN_INFO "player does not exist\n");
 		//player doesn't exist
 		//errno = ESRCH;
 		return -ESRCH;
 	}
-	if(!has_character(current_task) || !has_character(player_task)){
+	//hold the target party, the player may leave it or exit once we unlock
+	target = get_task_party(player_task);
+	read_unlock(&tasklist_lock);
+	if(!has_character(current_task) || target == NULL){
 		//printk(KERN_INFO "has no character\n");
 		//process or player does not havs a character
 		//errno = EINVAL;
+		if(target){
+			party_put(target);
+		}
 		return -EINVAL;
 	}
-	if(current_task->party_member == NOT_A_MEMBER){
-		//proccess in not a party member
-		//printk(KERN_INFO "player is not a party member\n");
-		struct player* tmp;
-		//obtain the first node, proccess node
-		tmp = list_entry(current_task->party_list.next, struct player, my_list);
-		//remove proccess node from his list
-		list_del(&tmp->my_list);
-		//add node to the player list
-		struct task_struct* leader = player_task->group_leader;
-		//printk(KERN_INFO "the leader's pid is %d\n",player_task->group_leader->pid);
-		list_add_tail(&tmp->my_list, &(leader->party_list));
-		current_task->group_leader = leader;
-		current_task->party_member = MEMBER;
-		player_task->party_member = MEMBER;
-	}else{
-		//proccess is a member of a party. check if proccess is a leader
-		if(current_task->group_leader == current_task){
-			//assign a different player as leader, moving the party to his party_list head.
-			moving_list(current_task,player_task);
-			player_task->party_member = MEMBER;
-
-		}else{
-			//proccess is not a leader
-			pid_t my_id = current_task->pid;
-			move_my_node(my_id,current_task->group_leader,player_task->group_leader);
-			current_task->group_leader = player_task->group_leader;
-			player_task->party_member = MEMBER;
-
-		}
+	struct rpg_party *mine = current_task->party;
+	if(mine == target){
+		//already in the player's party
+		party_put(target);
+		return SUCCESS;
 	}
+	lock_two_parties(mine, target);
+	if(target->size == 0 || target->dying){
+		//everyone left the party since we looked it up, or it is being killed
+		unlock_two_parties(mine, target);
+		party_put(target);
+		return -ESRCH;
+	}
+	//move my node, if i was the leader the party gets a new one
+	struct player *my_node = current_task->my_player;
+	party_remove(mine, current_task);
+	party_add(target, current_task, my_node);
+	rpg_trace(RPG_TRACE_JOIN, current_task, target, mine->id, 0, 0);
+	unlock_two_parties(mine, target);
+	//drop my member reference of the old party and the lookup reference
+	party_put(mine);
+	party_put(target);
 	
 	return SUCCESS;
 	
 }
 
 
-void moving_list(struct task_struct* source,struct task_struct* new){
-	pid_t source_id = source->pid;
-	pid_t dest_id = 0;
+/* copy up to count members of the party of player (0 for my own party) to
+	roster, starting after the first *cursor members, and advance *cursor.
+	returns the number of members copied, 0 once the roster is done.
+	members that join or leave between calls may be missed or seen twice */
+int sys_rpg_roster(pid_t player, struct rpg_member* roster, int count, int* cursor){
+	struct task_struct *current_task = current;
+	struct task_struct *player_task;
+	struct rpg_party *party;
+	int skip;
+	if(roster == NULL || cursor == NULL || count <= 0 || count > RPG_MAX_BATCH){
+		return -EINVAL;
+	}
+	if(get_user(skip, cursor)){
+		return -EFAULT;
+	}
+	if(skip < 0){
+		return -EINVAL;
+	}
+	read_lock(&tasklist_lock);
+	player_task = player ? find_task_by_pid(player) : current_task;
+	party = player_task ? get_task_party(player_task) : NULL;
+	read_unlock(&tasklist_lock);
+	if(party == NULL){
+		return player_task ? -EINVAL : -ESRCH;
+	}
+	struct rpg_member *members = (struct rpg_member *)kmalloc(count * sizeof(struct rpg_member), GFP_KERNEL);
+	if(members == NULL){
+		party_put(party);
+		return -ENOMEM;
+	}
 	struct player *entry;
-	struct list_head* tmp;
 	struct list_head* position;
-	//find a new leader
-    list_for_each_safe(position,tmp, &(source->party_list)){
-		entry = list_entry (position, struct player, my_list);
-		if(entry->player_pid != source_id){
-			dest_id = entry->player_pid;
-			break;
+	int n = 0, i = 0;
+	spin_lock(&party->lock);
+	list_for_each(position, &party->members){
+		if(i++ < skip){
+			continue;
 		}
-	}
-	struct task_struct* dest = find_task_by_pid(dest_id);
-	//move list to new leader head
-	list_splice(&source->party_list, &dest->party_list);
-	//delete source player node from dest list, add to new list and update leader
-	struct player *entry1;
-	struct list_head* tmp1;
-	struct list_head* position1;
-	list_for_each_safe(position1,tmp1, &(dest->party_list)){
-		entry1= list_entry (position1, struct player, my_list);
-		if(entry1->player_pid == source_id){
-			list_del(&entry1->my_list);
-			list_add_tail(&entry1->my_list, &new->group_leader->party_list);
-			source->group_leader = new->group_leader;
+		if(n == count){
 			break;
 		}
+		entry = list_entry (position, struct player, my_list);
+		members[n].pid = entry->player_pid;
+		members[n].cclass = entry->cclass;
+		members[n].level = entry->player_level;
+		members[n].leader = (entry->player_task == party->leader);
+		n++;
+	}
+	spin_unlock(&party->lock);
+	rpg_trace(RPG_TRACE_ROSTER, current_task, party, skip, n, 0);
+	party_put(party);
+	//one copy for the whole roster, outside the lock since it may sleep
+	int res = n;
+	if(copy_to_user(roster, members, n * sizeof(struct rpg_member)) || put_user(skip + n, cursor)){
+		res = -EFAULT;
 	}
-	//update leader in dest nodes
-	update_leader(dest);
+	kfree(members);
+	return res;
+}
 
+/* enroll count tasks that have no character yet in the party of player, each
+	with a new level 1 character of cclass. all under one party lock, status[i]
+	gets 0 or the error for pids[i]. needs CAP_SYS_ADMIN.
+	returns the number of tasks enrolled */
+int sys_rpg_join_many(pid_t player, pid_t* pids, int count, int cclass, int* status){
+	if(!capable(CAP_SYS_ADMIN)){
+		return -EPERM;
+	}
+	if(pids == NULL || status == NULL || count <= 0 || count > RPG_MAX_BATCH){
+		return -EINVAL;
+	}
+	if(cclass < 0 || cclass >= rpg_nr_classes){
+		return -EINVAL;
+	}
+	pid_t *ids = (pid_t *)kmalloc(count * sizeof(pid_t), GFP_KERNEL);
+	if(ids == NULL){
+		return -ENOMEM;
+	}
+	int *res = (int *)kmalloc(count * sizeof(int), GFP_KERNEL);
+	if(res == NULL){
+		kfree(ids);
+		return -ENOMEM;
+	}
+	int retval;
+	if(copy_from_user(ids, pids, count * sizeof(pid_t))){
+		retval = -EFAULT;
+		goto out;
+	}
+	struct task_struct *player_task, *proc;
+	struct rpg_party *target;
+	int i, joined = 0;
+	//tasklist_lock keeps the pids we look up from being released
+	read_lock(&tasklist_lock);
+	player_task = find_task_by_pid(player);
+	target = player_task ? get_task_party(player_task) : NULL;
+	if(target == NULL){
+		read_unlock(&tasklist_lock);
+		retval = player_task ? -EINVAL : -ESRCH;
+		goto out;
+	}
+	spin_lock(&target->lock);
+	if(target->size == 0 || target->dying){
+		retval = -ESRCH;
+	}else{
+		for(i = 0; i < count; i++){
+			proc = find_task_by_pid(ids[i]);
+			res[i] = proc ? party_enroll(target, proc, cclass) : -ESRCH;
+			if(res[i] == SUCCESS){
+				joined++;
+			}
+		}
+		retval = joined;
+		rpg_trace(RPG_TRACE_JOIN_MANY, current, target, count, joined, 0);
+	}
+	spin_unlock(&target->lock);
+	read_unlock(&tasklist_lock);
+	party_put(target);
+	//the status goes back outside the locks since it may sleep
+	if(retval >= 0 && copy_to_user(status, res, count * sizeof(int))){
+		retval = -EFAULT;
+	}
+out:
+	kfree(res);
+	kfree(ids);
+	return retval;
 }
 
-void update_leader(struct task_struct* dest){
+/* send sig to every member of my party, me included, in one pass.
+	a SIGKILL that reached every member marks the party dying so the exits
+	that follow skip the leader hand-off and nobody can join it anymore.
+	if some member was not signalled (EPERM) it stays, so the party must
+	stay alive for it. returns the number of members signalled */
+int sys_rpg_party_kill(int sig){
+	struct task_struct *current_task = current;
+	if(sig <= 0 || sig >= _NSIG){
+		return -EINVAL;
+	}
+	if(!has_character(current_task)){
+		return -EINVAL;
+	}
+	//permissions are checked per member like kill() does
+	struct siginfo info;
+	info.si_signo = sig;
+	info.si_errno = 0;
+	info.si_code = SI_USER;
+	info.si_pid = current_task->pid;
+	info.si_uid = current_task->uid;
+
+	struct rpg_party* party = current_task->party;
 	struct player *entry;
-	struct list_head* tmp;
 	struct list_head* position;
-	list_for_each_safe(position,tmp, &(dest->party_list)){
-		entry= list_entry (position, struct player, my_list);
-		struct task_struct* node = find_task_by_pid(entry->player_pid);
-		node->group_leader = dest;
+	int sent = 0, failed = 0, err, retval = -EPERM;
+	//tasklist_lock keeps the members from being released while we signal them
+	read_lock(&tasklist_lock);
+	spin_lock(&party->lock);
+	list_for_each(position, &party->members){
+		entry = list_entry (position, struct player, my_list);
+		err = send_sig_info(sig, &info, entry->player_task);
+		if(err == 0){
+			sent++;
+		}else{
+			failed++;
+			retval = err;
+		}
+	}
+	//the members can't exit before we unlock, they all see it
+	if(sig == SIGKILL && !failed){
+		party->dying = 1;
 	}
+	spin_unlock(&party->lock);
+	read_unlock(&tasklist_lock);
+	rpg_trace(RPG_TRACE_KILL, current_task, party, sig, sent, 0);
+	return sent ? sent : retval;
 }
 
 
-void move_my_node(pid_t my_id,struct task_struct* old_leader,struct task_struct* new_leader){
-	//locate my node in old leader list
-	struct player* entry;
-	struct list_head* tmp;
-	struct list_head* position;
-	list_for_each_safe(position,tmp, &(old_leader->party_list)){
-		entry= list_entry (position, struct player, my_list);
-		if(entry->player_pid == my_id){
-			list_del(&entry->my_list);
-			list_add_tail(&entry->my_list, &new_leader->party_list);
-			break;
+/* on != 0: children i fork from now on get a character of my class and
+	join my party, see rpg_fork_inherit(). returns the previous setting */
+int sys_rpg_inherit(int on){
+	struct task_struct *current_task = current;
+	if(on != 0 && on != 1){
+		return -EINVAL;
+	}
+	int old = current_task->rpg_inherit;
+	current_task->rpg_inherit = on;
+	rpg_trace(RPG_TRACE_INHERIT, current_task, current_task->party, on, 0, 0);
+	return old;
+}
+
+/******************************************************************************************************/
+/* /dev/rpg_stats, mmap() of one page maps the stats page of my party read
+	only. the mapping keeps showing that party after i leave it, so the
+	reader checks that its pid is still in one of the slots */
+
+static void rpg_stats_vm_open(struct vm_area_struct* vma){
+	get_page((struct page *)vma->vm_private_data);
+}
+
+static void rpg_stats_vm_close(struct vm_area_struct* vma){
+	put_page((struct page *)vma->vm_private_data);
+}
+
+static struct page* rpg_stats_vm_nopage(struct vm_area_struct* vma, unsigned long address, int unused){
+	struct page *page = (struct page *)vma->vm_private_data;
+	get_page(page);
+	return page;
+}
+
+static struct vm_operations_struct rpg_stats_vm_ops = {
+	open:	rpg_stats_vm_open,
+	close:	rpg_stats_vm_close,
+	nopage:	rpg_stats_vm_nopage,
+};
+
+static int rpg_stats_mmap(struct file* file, struct vm_area_struct* vma){
+	struct task_struct *current_task = current;
+	if(vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start != PAGE_SIZE){
+		return -EINVAL;
+	}
+	if(vma->vm_flags & VM_WRITE){
+		return -EPERM;
+	}
+	if(!has_character(current_task)){
+		return -EINVAL;
+	}
+	//only we change our party, so it can't go away under us
+	struct rpg_party *party = current_task->party;
+	//the first mapping of the party makes its page, allocated before
+	//taking the lock since it may sleep
+	struct rpg_stats_page *stats = NULL;
+	if(party->stats == NULL){
+		stats = (struct rpg_stats_page *)get_zeroed_page(GFP_KERNEL);
+		if(stats == NULL){
+			return -ENOMEM;
 		}
 	}
+	spin_lock(&party->lock);
+	if(party->stats == NULL){
+		stats_fill(party, stats);
+		stats = NULL;
+	}
+	struct page *page = virt_to_page(party->stats);
+	get_page(page);
+	spin_unlock(&party->lock);
+	if(stats){
+		//another member was first
+		free_page((unsigned long)stats);
+	}
+	vma->vm_private_data = page;
+	vma->vm_ops = &rpg_stats_vm_ops;
+	//no mprotect() to writable, and keep swap_out away from a kernel page
+	vma->vm_flags &= ~VM_MAYWRITE;
+	vma->vm_flags |= VM_RESERVED;
+	return 0;
+}
+
+static struct file_operations rpg_stats_fops = {
+	owner:	THIS_MODULE,
+	mmap:	rpg_stats_mmap,
+};
 
+static struct miscdevice rpg_stats_dev = {
+	minor:	MISC_DYNAMIC_MINOR,
+	name:	"rpg_stats",
+	fops:	&rpg_stats_fops,
+};
+
+static int __init rpg_stats_init(void){
+	return misc_register(&rpg_stats_dev);
 }
 
+__initcall(rpg_stats_init);
+
+/* /dev/rpg_trace, read() returns whole struct rpg_trace_event records, CPU
+	by CPU and oldest first. the file position counts the RPG_TRACE_SIZE
+	slots of every CPU, slots never written are skipped. write 1 or 0 to turn
+	tracing on or off */
+static ssize_t rpg_trace_read(struct file* file, char* buf, size_t count, loff_t* ppos){
+	struct rpg_trace_ring *ring;
+	struct rpg_trace_event e;
+	//the position stays far below 4G, no 64 bit division in the kernel
+	unsigned int slot = (unsigned int)*ppos / sizeof(struct rpg_trace_event);
+	unsigned int cpu, i, head;
+	size_t done = 0;
+	for(; slot < smp_num_cpus * RPG_TRACE_SIZE && done + sizeof(e) <= count; slot++){
+		cpu = cpu_logical_map(slot / RPG_TRACE_SIZE);
+		ring = rpg_traces + cpu;
+		head = ring->head;
+		i = slot % RPG_TRACE_SIZE;
+		//oldest first, skip entries never written
+		if(head < RPG_TRACE_SIZE){
+			if(i >= head){
+				continue;
+			}
+		}else{
+			i = (head + i) & (RPG_TRACE_SIZE - 1);
+		}
+		//copy the entry out first, the CPU may overwrite it while we fault
+		e = ring->entry[i];
+		if(copy_to_user(buf + done, &e, sizeof(e))){
+			return done ? done : -EFAULT;
+		}
+		done += sizeof(e);
+	}
+	*ppos = (loff_t)slot * sizeof(struct rpg_trace_event);
+	return done;
+}
+
+static ssize_t rpg_trace_write(struct file* file, const char* buf, size_t count, loff_t* ppos){
+	char c;
+	int cpu;
+	if(!capable(CAP_SYS_ADMIN)){
+		return -EPERM;
+	}
+	if(!count || get_user(c, buf)){
+		return -EFAULT;
+	}
+	if(c != '0' && c != '1'){
+		return -EINVAL;
+	}
+	//a fresh trace every time it is turned on
+	if(c == '1' && !rpg_trace_on){
+		for(cpu = 0; cpu < NR_CPUS; cpu++){
+			rpg_traces[cpu].head = 0;
+		}
+	}
+	rpg_trace_on = c - '0';
+	return count;
+}
+
+static struct file_operations rpg_trace_fops = {
+	owner:	THIS_MODULE,
+	read:	rpg_trace_read,
+	write:	rpg_trace_write,
+};
+
+static struct miscdevice rpg_trace_dev = {
+	minor:	MISC_DYNAMIC_MINOR,
+	name:	"rpg_trace",
+	fops:	&rpg_trace_fops,
+};
+
+static int __init rpg_trace_init(void){
+	return misc_register(&rpg_trace_dev);
+}
+
+__initcall(rpg_trace_init);
 
 /**************************************************************/
 int rpg_fork(struct task_struct* son){
 	
-	son->party_member = NOT_A_MEMBER;
-	
-	INIT_LIST_HEAD(&son->party_list);
-
-	son->group_leader = son;
+	//the child starts without a character, rpg_fork_inherit() may give it one
+	son->party = NULL;
+	son->my_player = NULL;
+	son->rpg_inherit = 0;
 	return 0;
 }
 
-/* need to fixing, to check if group leader, to delete the proccess node*/
-int rpg_exit(struct task_struct* proc){
-	pid_t my_id = proc->pid;
-	if(!has_character(proc)){
-		//proccess has no character
-		return 0;
+/* give the child a level 1 character of our class in our party when we asked
+	for it with sys_rpg_inherit(). do_fork() calls this once the fork can not
+	fail anymore, so there is nothing to undo */
+void rpg_fork_inherit(struct task_struct* son){
+	struct task_struct *father = current;
+	if(!father->rpg_inherit || !has_character(father)){
+		return;
 	}
-	//check if the proccess is a party leader
-	if(proc->group_leader == proc){
-		//assign new leader and delete my node
-		if(proc->party_member == NOT_A_MEMBER){
-			// only has one node in list, must delete
-			struct player *tmp = list_entry(proc->party_list.next, struct player, my_list);
-			//remove proccess node from his list
-			list_del(&tmp->my_list);
-			kfree(tmp);
-
-		}else{
-			pid_t dest_id;
-			struct player *entry;
-			struct list_head* tmp;
-			struct list_head* position;
-			//find my node and delete it
-			list_for_each_safe(position,tmp, &(proc->party_list)){
-				entry = list_entry (position, struct player, my_list);
-				if(entry->player_pid == my_id){
-					list_del(&entry->my_list);
-					kfree(entry);
-					break;
-				}
-			}
-			//check if list now empty
-			if(list_empty(&proc->party_list)){
-				return 0;
-			}
-			//find a new leader to the other nodes
-			struct player *entry1;
-			struct list_head* tmp1;
-			struct list_head* position1;
-			list_for_each_safe(position1,tmp1, &(proc->party_list)){
-				entry1= list_entry (position1, struct player, my_list);
-				if(entry1->player_pid != my_id){
-					dest_id = entry1->player_pid; 
-					break;
-				}
-			}
-			// find new leader task_struct
-			struct task_struct * new_leader = find_task_by_pid(dest_id);
-			//move list to new leader head
-			list_splice(&proc->party_list, &new_leader->party_list);
-			//update leader in new leader nodes
-			update_leader(new_leader);
-		}	
+	//our party can't go away under us, only we can leave it
+	struct rpg_party *party = father->party;
+	int res = -ESRCH;
+	spin_lock(&party->lock);
+	if(!party->dying){
+		res = party_enroll(party, son, father->my_player->cclass);
 	}
-	else{
-		// delete my node
-		struct task_struct *leader = proc->group_leader;
-		struct player* entry;
-		struct list_head* tmp;
-		struct list_head* position;
-		list_for_each_safe(position,tmp, &(leader->party_list)){
-			entry= list_entry (position, struct player, my_list);
-			if(entry->player_pid == my_id){
-				list_del(&entry->my_list);
-				kfree (entry);
-				break;
-			}
+	spin_unlock(&party->lock);
+	rpg_trace(RPG_TRACE_FORK, father, party, son->pid, res == SUCCESS, 0);
+}
 
-		}
+/* delete the proccess node, if it was the leader the party gets a new leader */
+int rpg_exit(struct task_struct* proc){
+	//under the lock: PF_EXITING is set, so sys_rpg_join_many() either enrolled
+	//us before this or will see the flag and leave us alone
+	struct rpg_party *party;
+	task_lock(proc);
+	party = proc->party;
+	task_unlock(proc);
+	if(party == NULL){
+		//proccess has no character
+		return 0;
 	}
+	spin_lock(&party->lock);
+	rpg_trace(RPG_TRACE_EXIT, proc, party, 0, 0, 0);
+	party_remove(party, proc);
+	task_lock(proc);
+	proc->party = NULL;
+	proc->my_player = NULL;
+	task_unlock(proc);
+	spin_unlock(&party->lock);
+	party_put(party);
 	return 0;
 
 }
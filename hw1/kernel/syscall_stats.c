@@ -0,0 +1,188 @@
+/*
+ *  kernel/syscall_stats.c
+ *
+ *  Per-syscall call counts and cycles, taken in the system_call and
+ *  tracesys paths of arch/i386/kernel/entry.S. ioctl() is also broken
+ *  out by character device major, so a driver like the chat device of
+ *  HW3 (my_ioctl) gets its own row.
+ */
+
+#include <linux/sched.h>
+#include <linux/sys.h>
+#include <linux/init.h>
+#include <linux/string.h>
+#include <linux/proc_fs.h>
+#include <linux/file.h>
+#include <linux/major.h>
+#include <asm/unistd.h>
+#include <asm/uaccess.h>
+#include <asm/ptrace.h>
+#include <asm/timex.h>
+#include <asm/div64.h>
+
+/*
+ * Every CPU counts the syscalls that return on it in its own table, so the
+ * counters need no lock and no shared cache line. The cycles run from the
+ * entry to the return of the syscall, time spent asleep included.
+ * Off by default, system_call then pays one test of syscall_stats_on.
+ * Read /proc/syscall_stats, write 1 or 0 to it to turn accounting on or off.
+ * An ioctl() on a character device counts in the ioctl row and in an
+ * "ioctl:<major>" row, /proc/devices names the majors.
+ */
+struct syscall_stat {
+	unsigned long long cycles;
+	unsigned long calls;
+};
+
+struct syscall_stats {
+	struct syscall_stat stat[NR_syscalls];
+	struct syscall_stat ioctl[MAX_CHRDEV];	/* by device major */
+} ____cacheline_aligned;
+
+static struct syscall_stats syscall_stats[NR_CPUS];
+int syscall_stats_on;	/* tested in entry.S */
+
+/* called before the syscall, regs is the frame SAVE_ALL built. tracesys
+	calls us with accounting off too, then we clear what a fork may have
+	copied from the parent */
+asmlinkage void syscall_stat_enter(struct pt_regs regs)
+{
+	struct task_struct *p = current;
+	struct inode *inode;
+	struct file *file;
+
+	if (!syscall_stats_on) {
+		p->syscall_tsc = 0;
+		return;
+	}
+	p->syscall_nr = regs.orig_eax;
+	p->syscall_dev = 0;
+	//the device an ioctl goes to, the fd is in ebx
+	if (regs.orig_eax == __NR_ioctl && (file = fget(regs.ebx))) {
+		inode = file->f_dentry->d_inode;
+		if (S_ISCHR(inode->i_mode) && MAJOR(inode->i_rdev) < MAX_CHRDEV)
+			p->syscall_dev = MAJOR(inode->i_rdev) + 1;
+		fput(file);
+	}
+	p->syscall_tsc = get_cycles();
+}
+
+/* called once the syscall returned. sigreturn rewrites the frame, so the
+	number comes from syscall_stat_enter() and not from regs */
+asmlinkage void syscall_stat_exit(void)
+{
+	struct task_struct *p = current;
+	struct syscall_stats *stats;
+	unsigned long long cycles;
+
+	//entered while accounting was off
+	if (!p->syscall_tsc)
+		return;
+	cycles = get_cycles() - p->syscall_tsc;
+	stats = syscall_stats + smp_processor_id();
+	stats->stat[p->syscall_nr].calls++;
+	stats->stat[p->syscall_nr].cycles += cycles;
+	if (p->syscall_dev) {
+		stats->ioctl[p->syscall_dev - 1].calls++;
+		stats->ioctl[p->syscall_dev - 1].cycles += cycles;
+	}
+	p->syscall_tsc = 0;
+}
+
+/* the table has a header row and then one row per syscall number and per
+	ioctl device major. off is not a byte count: it holds the row in its high
+	bits and how much of that row was read already in the low ones, so a
+	reader with a small buffer gets a row in pieces. we tell proc how far
+	off moved through *start */
+#define SYSCALL_STATS_ROWS (1 + NR_syscalls + MAX_CHRDEV)
+#define SYSCALL_STATS_SHIFT 8	/* a row is shorter than 1 << 8 */
+#define SYSCALL_STATS_OFF(row, skip) (((off_t)(row) << SYSCALL_STATS_SHIFT) | (skip))
+
+/* print row into buf, returns its length, 0 for a syscall never called */
+static int syscall_stats_row(char *buf, int row)
+{
+	unsigned long long cycles = 0, avg;
+	struct syscall_stat *s;
+	unsigned long calls = 0;
+	int i, cpu, nr = row - 1, len;
+
+	if (row == 0)
+		return sprintf(buf, "nr calls cycles avg\n");
+	for (i = 0; i < smp_num_cpus; i++) {
+		cpu = cpu_logical_map(i);
+		if (nr < NR_syscalls)
+			s = syscall_stats[cpu].stat + nr;
+		else
+			s = syscall_stats[cpu].ioctl + nr - NR_syscalls;
+		calls += s->calls;
+		cycles += s->cycles;
+	}
+	if (!calls)
+		return 0;
+	avg = cycles;
+	do_div(avg, calls);
+	if (nr < NR_syscalls)
+		len = sprintf(buf, "%d", nr);
+	else
+		len = sprintf(buf, "ioctl:%d", nr - NR_syscalls);
+	return len + sprintf(buf + len, " %lu %llu %llu\n", calls, cycles, avg);
+}
+
+static int syscall_stats_read(char *page, char **start, off_t off,
+	int count, int *eof, void *data)
+{
+	int row = off >> SYSCALL_STATS_SHIFT;
+	int skip = off & ((1 << SYSCALL_STATS_SHIFT) - 1);
+	int len = 0, n;
+	char buf[1 << SYSCALL_STATS_SHIFT];
+
+	for (; row < SYSCALL_STATS_ROWS && len < count; row++, skip = 0) {
+		//the row may have grown or shrunk since the first piece was read
+		n = syscall_stats_row(buf, row) - skip;
+		if (n <= 0)
+			continue;
+		if (n > count - len) {
+			memcpy(page + len, buf + skip, count - len);
+			skip += count - len;
+			len = count;
+			break;
+		}
+		memcpy(page + len, buf + skip, n);
+		len += n;
+	}
+	if (row >= SYSCALL_STATS_ROWS)
+		*eof = 1;
+	*start = (char *)(long)(SYSCALL_STATS_OFF(row, skip) - off);
+	return len;
+}
+
+static int syscall_stats_write(struct file *file, const char *buffer,
+	unsigned long count, void *data)
+{
+	char c;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	if (!count || get_user(c, buffer))
+		return -EFAULT;
+	if (c != '0' && c != '1')
+		return -EINVAL;
+	//fresh counters every time it is turned on
+	if (c == '1' && !syscall_stats_on)
+		memset(syscall_stats, 0, sizeof(syscall_stats));
+	syscall_stats_on = c - '0';
+	return count;
+}
+
+static int __init syscall_stats_init(void)
+{
+	struct proc_dir_entry *entry;
+
+	entry = create_proc_entry("syscall_stats", 0644, NULL);
+	if (entry) {
+		entry->read_proc = syscall_stats_read;
+		entry->write_proc = syscall_stats_write;
+	}
+	return 0;
+}
+__initcall(syscall_stats_init);
@@ -1,6 +1,12 @@
 #include <stdio.h>
 #include <errno.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* the kernel saves every register but eax across int $0x80, so the
+   arguments go straight in the registers the syscall reads them from */
 
 
 
@@ -13,22 +19,75 @@ struct rpg_stats {
 	int mage_levels;
 };
 
+/* create rpg_stats_page struct, the read-only page the kernel publishes for
+	my party, see rpg_stats_map(). seq is odd while the kernel changes it */
+struct rpg_stats_slot {
+	pid_t pid;
+	int cclass;
+	int level;
+};
+
+struct rpg_stats_page {
+	unsigned int seq;
+	int party_size;
+	int fighter_levels;
+	int mage_levels;
+	pid_t leader;
+	unsigned int epoch;
+	int nr_slots;
+	struct rpg_stats_slot slots[0];
+};
+
+#define RPG_STATS_PAGE_SIZE 4096
+
+/* create rpg_trace_event struct, one record read from /dev/rpg_trace.
+	write 1 or 0 to the device to turn the trace on or off (root only) */
+#define RPG_TRACE_CREATE	0	/* cclass */
+#define RPG_TRACE_FIGHT		1	/* type, level, result */
+#define RPG_TRACE_FIGHT_BATCH	2	/* count, wins */
+#define RPG_TRACE_STATS		3
+#define RPG_TRACE_JOIN		4	/* id of the party left */
+#define RPG_TRACE_KILL		5	/* sig, members signalled */
+#define RPG_TRACE_INHERIT	6	/* on */
+#define RPG_TRACE_JOIN_MANY	7	/* count, joined */
+#define RPG_TRACE_ROSTER	8	/* cursor, copied */
+#define RPG_TRACE_WEIGHTS	9	/* creatures, classes */
+#define RPG_TRACE_LEADER	10	/* new leader pid, 0 for none */
+#define RPG_TRACE_FORK		11	/* child pid, 1 if it joined */
+#define RPG_TRACE_EXIT		12
+
+struct rpg_trace_event {
+	unsigned long long tsc;
+	pid_t pid;
+	unsigned int party;
+	unsigned short event;
+	unsigned short cpu;
+	int arg[3];
+};
+
+/* create rpg_member struct, one member in the roster of rpg_roster */
+struct rpg_member {
+	pid_t pid;
+	int cclass;
+	int level;
+	int leader;
+};
+
+/* create rpg_encounter struct, one fight of rpg_fight_batch */
+struct rpg_encounter {
+	int type;
+	int level;
+};
+
 
 /*rpg_create wrapper function*/
 int rpg_create_character(int cclass){
 	int res;
-	__asm__
+	__asm__ __volatile__
 	(
-		"pushl %%eax;"
-		"pushl %%ebx;"
-		"movl $243, %%eax;"
-		"movl %1, %%ebx;"
 		"int $0x80;"
-		"movl %%eax,%0;"
-		"popl %%ebx;"
-		"popl %%eax;"
-		: "=m" (res)
-		: "m" (cclass)
+		: "=a" (res)
+		: "0" (243), "b" (cclass)
 	);
 	if (res < 0)
 	{
@@ -42,21 +101,11 @@ int rpg_create_character(int cclass){
 /*rpg_fight wrapper function*/
 int rpg_fight(int type , int level){
 	int res;
-	__asm__
+	__asm__ __volatile__
 	(
-		"pushl %%eax;"
-		"pushl %%ebx;"
-		"pushl %%ecx;"
-		"movl $244, %%eax;"
-		"movl %1, %%ebx;"
-		"movl %2, %%ecx;"
 		"int $0x80;"
-		"movl %%eax,%0;"
-		"popl %%ecx;"
-		"popl %%ebx;"
-		"popl %%eax;"
-		: "=m" (res)
-		: "m" (type), "m" (level)
+		: "=a" (res)
+		: "0" (244), "b" (type), "c" (level)
 	);
 	if (res < 0)
 	{
@@ -67,21 +116,158 @@ int rpg_fight(int type , int level){
 	
 }
 
-/*rpg_stat wrapper function*/
+/*rpg_fight_batch wrapper function
+	fights count encounters, bit i of results is set if encounter i was won.
+	results must hold (count+31)/32 ints. returns the number of wins */
+int rpg_fight_batch(struct rpg_encounter* encounters, int count, unsigned int* results){
+	int res;
+	__asm__ __volatile__
+	(
+		"int $0x80;"
+		: "=a" (res)
+		: "0" (247), "b" (encounters), "c" (count), "d" (results)
+		: "memory"
+	);
+	if (res < 0)
+	{
+		errno = -res;
+		res = -1;
+	}
+	return res;
+	
+}
+
+/* the stats page of my party once rpg_stats_map() mapped it, and the slot
+	i was found in last time */
+static const volatile struct rpg_stats_page* rpg_stats_page = NULL;
+static int rpg_stats_slot = 0;
+
+/* who the page answers for. by default every read asks getpid(), which
+	is right for threads (LinuxThreads gives each its own pid), vfork and
+	clone children. rpg_stats_map_cached() keeps the pid instead */
+static pid_t rpg_stats_pid = 0;
+static int rpg_stats_cached = 0;
+static int rpg_stats_atfork = 0;
+
+/* in libpthread on older glibc: weak, so a program without -lpthread
+	still links and just can not use rpg_stats_map_cached() */
+extern int pthread_atfork(void (*prepare)(void), void (*parent)(void),
+	void (*child)(void)) __attribute__((weak));
+
+static void rpg_stats_child(void){
+	rpg_stats_pid = getpid();
+	rpg_stats_slot = 0;
+}
+
+/*rpg_stats_map function
+	maps the stats page of my party from /dev/rpg_stats, from then on
+	rpg_get_stats() reads my stats from it without the stats syscall.
+	rpg_join() maps the page of the new party by itself */
+int rpg_stats_map(void){
+	int fd = open("/dev/rpg_stats", O_RDONLY);
+	if (fd < 0)
+	{
+		return -1;
+	}
+	void* page = mmap(NULL, RPG_STATS_PAGE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (page == MAP_FAILED)
+	{
+		return -1;
+	}
+	if (rpg_stats_page != NULL)
+	{
+		munmap((void*)rpg_stats_page, RPG_STATS_PAGE_SIZE);
+	}
+	rpg_stats_slot = 0;
+	rpg_stats_page = page;
+	return 0;
+}
+
+/*rpg_stats_map_cached function
+	rpg_stats_map() for a process with a single thread and no vfork() or
+	clone(CLONE_VM) children: reads use the pid kept here, no getpid().
+	a forked child refreshes it through pthread_atfork(), ENOSYS when
+	that is not linked in (-lpthread on older glibc) */
+int rpg_stats_map_cached(void){
+	if (!rpg_stats_atfork)
+	{
+		if (pthread_atfork == NULL)
+		{
+			errno = ENOSYS;
+			return -1;
+		}
+		//fork copies the mapping but the child has another pid
+		if (pthread_atfork(NULL, NULL, rpg_stats_child) != 0)
+		{
+			return -1;
+		}
+		rpg_stats_atfork = 1;
+	}
+	if (rpg_stats_map() < 0)
+	{
+		return -1;
+	}
+	rpg_stats_child();
+	rpg_stats_cached = 1;
+	return 0;
+}
+
+/* read my stats from the stats page, returns 0 if i am not in it (i left
+	the party, or it was full when i joined) and the kernel has to be asked.
+	x86 does not reorder loads, so keeping the compiler from doing it is
+	enough between the two reads of seq */
+static int rpg_stats_read(struct rpg_stats* stats){
+	const volatile struct rpg_stats_page* page = rpg_stats_page;
+	pid_t pid = rpg_stats_cached ? rpg_stats_pid : getpid();
+	int nr_slots = page->nr_slots;
+	unsigned int seq;
+	int slot;
+	do
+	{
+		seq = page->seq;
+		__asm__ __volatile__("" : : : "memory");
+		slot = rpg_stats_slot;
+		if (page->slots[slot].pid != pid)
+		{
+			for (slot = 0; slot < nr_slots; slot++)
+			{
+				if (page->slots[slot].pid == pid)
+					break;
+			}
+		}
+		if (slot < nr_slots)
+		{
+			stats->cclass = page->slots[slot].cclass;
+			stats->level = page->slots[slot].level;
+			stats->party_size = page->party_size;
+			stats->fighter_levels = page->fighter_levels;
+			stats->mage_levels = page->mage_levels;
+		}
+		__asm__ __volatile__("" : : : "memory");
+	} while ((seq & 1) || page->seq != seq);
+	if (slot == nr_slots)
+	{
+		return 0;
+	}
+	rpg_stats_slot = slot;
+	return 1;
+}
+
+/*rpg_stat wrapper function
+	reads the stats page when it is mapped and i am in it, no syscall */
 int rpg_get_stats(struct rpg_stats* stats){
 	int res;
-	__asm__
+	if (stats != NULL && rpg_stats_page != NULL && rpg_stats_read(stats))
+	{
+		return 0;
+	}
+	__asm__ __volatile__
 	(
-		"pushl %%eax;"
-		"pushl %%ebx;"
-		"movl $245, %%eax;"
-		"movl %1, %%ebx;"
 		"int $0x80;"
-		"movl %%eax,%0;"
-		"popl %%ebx;"
-		"popl %%eax;"
-		: "=m" (res)
-		: "m" (stats)
+		: "=a" (res)
+		: "0" (245), "b" (stats)
+		: "memory"
 	);
 	if (res < 0)
 	{
@@ -95,27 +281,126 @@ int rpg_get_stats(struct rpg_stats* stats){
 /*rpg_join wrapper function*/
 int rpg_join(pid_t player){
 	int res;
-	__asm__
+	__asm__ __volatile__
 	(
-		"pushl %%eax;"
-		"pushl %%ebx;"
-		"movl $246, %%eax;"
-		"movl %1, %%ebx;"
 		"int $0x80;"
-		"movl %%eax,%0;"
-		"popl %%ebx;"
-		"popl %%eax;"
-		: "=m" (res)
-		: "m" (player)
+		: "=a" (res)
+		: "0" (246), "b" (player)
 	);
 	if (res < 0)
 	{
 		errno = -res;
 		res = -1;
 	}
+	else if (rpg_stats_page != NULL)
+	{
+		//follow the new party, the old page works with the syscall if this fails
+		rpg_stats_map();
+	}
 	return res;	
 }
 
+/*rpg_party_kill wrapper function
+	sends sig to every member of my party, me included.
+	returns the number of members signalled */
+int rpg_party_kill(int sig){
+	int res;
+	__asm__ __volatile__
+	(
+		"int $0x80;"
+		: "=a" (res)
+		: "0" (248), "b" (sig)
+	);
+	if (res < 0)
+	{
+		errno = -res;
+		res = -1;
+	}
+	return res;
+}
+
+/*rpg_inherit wrapper function
+	on = 1: children i fork get a character of my class in my party.
+	returns the previous setting */
+int rpg_inherit(int on){
+	int res;
+	__asm__ __volatile__
+	(
+		"int $0x80;"
+		: "=a" (res)
+		: "0" (249), "b" (on)
+	);
+	if (res < 0)
+	{
+		errno = -res;
+		res = -1;
+	}
+	return res;
+}
+
+/*rpg_join_many wrapper function
+	gives each of count pids without a character a new character of cclass
+	in the party of player. status[i] gets 0 or the errno for pids[i] as a
+	negative number. needs root. returns the number of pids enrolled */
+int rpg_join_many(pid_t player, pid_t* pids, int count, int cclass, int* status){
+	int res;
+	__asm__ __volatile__
+	(
+		"int $0x80;"
+		: "=a" (res)
+		: "0" (250), "b" (player), "c" (pids), "d" (count), "S" (cclass), "D" (status)
+		: "memory"
+	);
+	if (res < 0)
+	{
+		errno = -res;
+		res = -1;
+	}
+	return res;
+}
+
+/*rpg_roster wrapper function
+	copies up to count members of the party of player (0 for mine) to roster.
+	set *cursor to 0 for the first call and pass it back unchanged to get
+	the next members. returns the number of members copied, 0 at the end */
+int rpg_roster(pid_t player, struct rpg_member* roster, int count, int* cursor){
+	int res;
+	__asm__ __volatile__
+	(
+		"int $0x80;"
+		: "=a" (res)
+		: "0" (251), "b" (player), "c" (roster), "d" (count), "S" (cursor)
+		: "memory"
+	);
+	if (res < 0)
+	{
+		errno = -res;
+		res = -1;
+	}
+	return res;
+}
+
+/*rpg_set_weights wrapper function
+	loads the strength table, weights[creature * classes + class] is the
+	weight of a class against a creature. the two built-in creatures and
+	classes keep their numbers, classes can only be added. needs root */
+int rpg_set_weights(int* weights, int creatures, int classes){
+	int res;
+	__asm__ __volatile__
+	(
+		"int $0x80;"
+		: "=a" (res)
+		: "0" (252), "b" (weights), "c" (creatures), "d" (classes)
+		: "memory"
+	);
+	if (res < 0)
+	{
+		errno = -res;
+		res = -1;
+	}
+	return res;
+}
+
 
 
 
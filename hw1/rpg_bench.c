@@ -0,0 +1,164 @@
+/*
+ * rpg_bench.c - calls per second of the rpg_api.h wrappers
+ *
+ * Runs on the hw1 kernel. Times rpg_get_stats and rpg_fight through the
+ * old wrappers, which saved registers by hand and passed the arguments
+ * through memory, and through the register constraint wrappers of
+ * rpg_api.h. It also times the stats page read of rpg_get_stats, which
+ * makes no stats syscall once rpg_stats_map() succeeded (only getpid()),
+ * and none at all with rpg_stats_map_cached(), and getppid() as the cost
+ * of an empty int $0x80 round trip.
+ *
+ * Build: gcc -O2 -Wall -o rpg_bench rpg_bench.c [-lpthread]
+ * (without -lpthread an older glibc has no pthread_atfork(), the cached
+ * page row is skipped)
+ * Run:   ./rpg_bench [-n calls]
+ */
+#include <stdlib.h>
+#include <sys/time.h>
+#include "rpg_api.h"
+
+#define FIGHTER 0
+#define CREATURE_ORC 0
+
+/* the rpg_get_stats wrapper before the register rewrite */
+static int old_rpg_get_stats(struct rpg_stats* stats){
+	int res;
+	__asm__
+	(
+		"pushl %%eax;"
+		"pushl %%ebx;"
+		"movl $245, %%eax;"
+		"movl %1, %%ebx;"
+		"int $0x80;"
+		"movl %%eax,%0;"
+		"popl %%ebx;"
+		"popl %%eax;"
+		: "=m" (res)
+		: "m" (stats)
+	);
+	if (res < 0)
+	{
+		errno = -res;
+		res = -1;
+	}
+	return res;
+}
+
+/* the rpg_fight wrapper before the register rewrite */
+static int old_rpg_fight(int type , int level){
+	int res;
+	__asm__
+	(
+		"pushl %%eax;"
+		"pushl %%ebx;"
+		"pushl %%ecx;"
+		"movl $244, %%eax;"
+		"movl %1, %%ebx;"
+		"movl %2, %%ecx;"
+		"int $0x80;"
+		"movl %%eax,%0;"
+		"popl %%ecx;"
+		"popl %%ebx;"
+		"popl %%eax;"
+		: "=m" (res)
+		: "m" (type), "m" (level)
+	);
+	if (res < 0)
+	{
+		errno = -res;
+		res = -1;
+	}
+	return res;
+}
+
+/* getppid(), the glibc of this kernel does not cache it */
+static int sys_getppid(void){
+	int res;
+	__asm__ __volatile__
+	(
+		"int $0x80;"
+		: "=a" (res)
+		: "0" (64)
+	);
+	return res;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void report(const char *what, long calls, double start)
+{
+	double secs = now() - start;
+
+	printf("%-24s %10.0f calls/s %8.3f us/call\n", what,
+		calls / secs, secs * 1e6 / calls);
+}
+
+int main(int argc, char **argv)
+{
+	struct rpg_stats stats;
+	long calls = 1000000, i;
+	double start;
+	int c;
+
+	while ((c = getopt(argc, argv, "n:")) != -1) {
+		if (c != 'n' || (calls = atol(optarg)) <= 0) {
+			fprintf(stderr, "usage: %s [-n calls]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (rpg_create_character(FIGHTER) < 0) {
+		perror("rpg_create_character");
+		return 1;
+	}
+
+	start = now();
+	for (i = 0; i < calls; i++)
+		sys_getppid();
+	report("getppid", calls, start);
+
+	start = now();
+	for (i = 0; i < calls; i++)
+		old_rpg_get_stats(&stats);
+	report("rpg_get_stats, before", calls, start);
+
+	start = now();
+	for (i = 0; i < calls; i++)
+		rpg_get_stats(&stats);
+	report("rpg_get_stats, after", calls, start);
+
+	start = now();
+	for (i = 0; i < calls; i++)
+		old_rpg_fight(CREATURE_ORC, 0);
+	report("rpg_fight, before", calls, start);
+
+	start = now();
+	for (i = 0; i < calls; i++)
+		rpg_fight(CREATURE_ORC, 0);
+	report("rpg_fight, after", calls, start);
+
+	if (rpg_stats_map() < 0) {
+		perror("rpg_stats_map, no stats page");
+		return 0;
+	}
+	start = now();
+	for (i = 0; i < calls; i++)
+		rpg_get_stats(&stats);
+	report("rpg_get_stats, page", calls, start);
+
+	if (rpg_stats_map_cached() < 0) {
+		perror("rpg_stats_map_cached");
+		return 0;
+	}
+	start = now();
+	for (i = 0; i < calls; i++)
+		rpg_get_stats(&stats);
+	report("rpg_get_stats, cached", calls, start);
+	return 0;
+}
@@ -0,0 +1,262 @@
+/*
+ * rpg_stress.c - concurrent join/fight/exit storms against the RPG syscalls
+ *
+ * Runs on the hw1 kernel. A few anchor processes hold a character each
+ * and stay alive as join targets, while workers create characters, join
+ * random anchors, fight, read their stats and rosters, signal their party
+ * and exit, and are respawned right away, all at once. So every path that
+ * takes a party lock, task_lock() or tasklist_lock (sys_rpg_join between
+ * two parties, rpg_exit() handing the leader over, rpg_fork_inherit(),
+ * sys_rpg_party_kill() walking a party) runs against the others.
+ *
+ * Every worker checks what one syscall returns in a single snapshot,
+ * which the locking has to keep consistent:
+ *	rpg_get_stats: my level is counted in the sum of my class, my
+ *		party has at least me in it
+ *	rpg_roster: one call is copied under the party lock, so the members
+ *		are unique, i am one of them and there is exactly one leader
+ *	all calls: no error other than the ones a race may legally give
+ *		(a join target that just exited: ESRCH or EINVAL)
+ * A lockup or an oops shows as the run never finishing.
+ *
+ * Build: gcc -O2 -Wall -o rpg_stress rpg_stress.c
+ * Run:   ./rpg_stress [-a anchors] [-w workers] [-t seconds]
+ * Exits 1 if any check failed.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+#include "rpg_api.h"
+
+#define FIGHTER 0
+#define MAGE 1
+#define MAX_PROCS 1024
+#define ROSTER_MAX 1024
+
+/* counters shared by all the processes */
+struct stress_stats {
+	volatile unsigned long ops, joins, fights, checks, exits, failures;
+};
+
+static struct stress_stats *stats;
+static pid_t anchors[MAX_PROCS];
+static int nr_anchors = 4;
+
+/* the counters are bumped by many processes at once */
+static void atomic_inc(volatile unsigned long *v)
+{
+	__asm__ __volatile__("lock; incl %0" : "+m" (*v));
+}
+
+static void fail(const char *what)
+{
+	fprintf(stderr, "pid %d: %s (errno %d)\n", getpid(), what, errno);
+	atomic_inc(&stats->failures);
+}
+
+/* one more operation, of the kind counter counts if it is not NULL */
+static void count(volatile unsigned long *counter)
+{
+	if (counter)
+		atomic_inc(counter);
+	atomic_inc(&stats->ops);
+}
+
+static void check_stats(void)
+{
+	struct rpg_stats s;
+
+	if (rpg_get_stats(&s) < 0) {
+		fail("rpg_get_stats");
+		return;
+	}
+	if (s.party_size < 1 || s.level < 0)
+		fail("rpg_get_stats: bad size or level");
+	if (s.cclass == FIGHTER ? s.level > s.fighter_levels : s.level > s.mage_levels)
+		fail("rpg_get_stats: my level is not in my class sum");
+	count(&stats->checks);
+}
+
+static void check_roster(void)
+{
+	static struct rpg_member roster[ROSTER_MAX];
+	int cursor = 0, n, i, j, leaders = 0, me = 0;
+
+	n = rpg_roster(0, roster, ROSTER_MAX, &cursor);
+	if (n < 0) {
+		fail("rpg_roster");
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		leaders += roster[i].leader;
+		me += roster[i].pid == getpid();
+		for (j = 0; j < i; j++)
+			if (roster[j].pid == roster[i].pid)
+				fail("rpg_roster: a member is listed twice");
+	}
+	//a party that fits in one call
+	if (n < ROSTER_MAX && (leaders != 1 || me != 1))
+		fail("rpg_roster: not one leader, or i am missing");
+	count(&stats->checks);
+}
+
+/* one worker: a character, then random operations until it decides to exit */
+static void worker(unsigned int seed)
+{
+	struct rpg_encounter fights[8];
+	unsigned int results;
+	int i, left;
+
+	srand(seed);
+	signal(SIGUSR1, SIG_IGN);
+	if (rpg_create_character(rand() % 2 ? MAGE : FIGHTER) < 0) {
+		fail("rpg_create_character");
+		exit(1);
+	}
+	for (left = 1 + rand() % 200; left; left--) {
+		switch (rand() % 8) {
+		case 0:
+		case 1:
+			//the anchor may be between characters, that is not a bug
+			if (rpg_join(anchors[rand() % nr_anchors]) < 0 &&
+					errno != ESRCH && errno != EINVAL)
+				fail("rpg_join");
+			count(&stats->joins);
+			break;
+		case 2:
+			if (rpg_fight(rand() % 2, rand() % 20) < 0)
+				fail("rpg_fight");
+			count(&stats->fights);
+			break;
+		case 3:
+			for (i = 0; i < 8; i++) {
+				fights[i].type = rand() % 2;
+				fights[i].level = rand() % 20;
+			}
+			if (rpg_fight_batch(fights, 8, &results) < 0)
+				fail("rpg_fight_batch");
+			count(&stats->fights);
+			break;
+		case 4:
+			check_stats();
+			break;
+		case 5:
+			check_roster();
+			break;
+		case 6:
+			//walks the party under its lock while members exit
+			if (rpg_party_kill(SIGUSR1) < 0 && errno != EPERM)
+				fail("rpg_party_kill");
+			count(NULL);
+			break;
+		case 7:
+			//a child that joins my party and exits at once
+			rpg_inherit(1);
+			if (fork() == 0)
+				_exit(0);
+			rpg_inherit(0);
+			while (waitpid(-1, NULL, WNOHANG) > 0)
+				;
+			count(NULL);
+			break;
+		}
+	}
+	count(&stats->exits);
+	exit(0);
+}
+
+/* an anchor keeps a character as a join target and fights now and then */
+static void anchor(int i)
+{
+	signal(SIGUSR1, SIG_IGN);
+	if (rpg_create_character(i % 2 ? MAGE : FIGHTER) < 0) {
+		fail("anchor: rpg_create_character");
+		exit(1);
+	}
+	for (;;) {
+		if (rpg_fight(i % 2, 5) < 0)
+			fail("anchor: rpg_fight");
+		usleep(1000);
+	}
+}
+
+static pid_t spawn_worker(unsigned int seed)
+{
+	pid_t pid = fork();
+
+	if (pid == 0)
+		worker(seed);
+	if (pid < 0)
+		perror("fork");
+	return pid;
+}
+
+int main(int argc, char **argv)
+{
+	int nr_workers = 32, seconds = 10, live, i, c, status;
+	unsigned int seed = 1;
+	time_t end;
+	pid_t pid;
+
+	while ((c = getopt(argc, argv, "a:w:t:")) != -1) {
+		switch (c) {
+		case 'a':
+			nr_anchors = atoi(optarg);
+			break;
+		case 'w':
+			nr_workers = atoi(optarg);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-a anchors] [-w workers] [-t seconds]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (nr_anchors < 1 || nr_anchors > MAX_PROCS || nr_workers < 1 || nr_workers > MAX_PROCS) {
+		fprintf(stderr, "1 to %d anchors and workers\n", MAX_PROCS);
+		return 1;
+	}
+	stats = mmap(NULL, sizeof(*stats), PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (stats == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < nr_anchors; i++) {
+		anchors[i] = fork();
+		if (anchors[i] == 0)
+			anchor(i);
+	}
+	//let the anchors create their characters first
+	sleep(1);
+
+	for (live = 0; live < nr_workers; live++)
+		if (spawn_worker(seed++) < 0)
+			break;
+	end = time(NULL) + seconds;
+	while (time(NULL) < end) {
+		pid = wait(&status);
+		if (pid < 0)
+			break;
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			atomic_inc(&stats->failures);
+		//the exit storm goes on: every worker that leaves is replaced
+		spawn_worker(seed++);
+	}
+	for (i = 0; i < nr_anchors; i++)
+		kill(anchors[i], SIGKILL);
+	while (wait(&status) > 0)
+		;
+
+	printf("%d anchors, %d workers, %d seconds\n", nr_anchors, nr_workers, seconds);
+	printf("ops %lu (%lu/s) joins %lu fights %lu checks %lu exits %lu\n",
+		stats->ops, stats->ops / (seconds ? seconds : 1), stats->joins,
+		stats->fights, stats->checks, stats->exits);
+	printf("failures %lu\n", stats->failures);
+	return stats->failures ? 1 : 0;
+}